@@ -8,10 +8,30 @@ LOCAL_MODULE := vncd
 LOCAL_INIT_RC := vncd.rc
 
 LOCAL_SRC_FILES := \
+    common/log.cpp \
     input/suinput.cpp \
+    input/injector.cpp \
     input/input.cpp \
     input/clipboard.cpp \
+    input/keymap.cpp \
+    input/touch.cpp \
+    screen/capture.cpp \
+    screen/compare.cpp \
     screen/flinger.cpp \
+    screen/framedump.cpp \
+    screen/framefile.cpp \
+    server/backlog.cpp \
+    server/client.cpp \
+    server/continuous.cpp \
+    server/cuttext.cpp \
+    server/events.cpp \
+    server/latency.cpp \
+    server/metrics.cpp \
+    server/multitouch.cpp \
+    server/quality.cpp \
+    server/recording.cpp \
+    server/snapshot.cpp \
+    server/transfer.cpp \
     vncd.cpp
 
 LOCAL_C_INCLUDES := \
@@ -19,6 +39,7 @@ LOCAL_C_INCLUDES := \
     $(LOCAL_PATH)/common \
     $(LOCAL_PATH)/input \
     $(LOCAL_PATH)/screen \
+    $(LOCAL_PATH)/server \
     external/zlib \
     external/libvncserver
 
@@ -0,0 +1,471 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// replays frames through the capture and encoding path of vncd on a Linux host:
+// change detection, scaling, pixel format conversion and every RFB encoding,
+// the updates go through loopback connections to clients which drop them
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+
+extern "C" {
+    #include "rfb/rfb.h"
+    #include "rfb/rfbregion.h"
+
+    // exported by libvncserver, but only declared in its private scale.h
+    void rfbScalingSetup(rfbClientPtr cl, int width, int height);
+    void rfbScaledScreenUpdate(rfbScreenInfoPtr screen, int x1, int y1, int x2, int y2);
+}
+
+#include "compare.h"
+#include "frames.h"
+
+#define MAX_ENCODINGS 16
+
+struct encodingEntry
+{
+    const char* name;
+    int encoding;
+};
+
+static const encodingEntry knownEncodings[] = {
+    { "raw", rfbEncodingRaw },
+    { "rre", rfbEncodingRRE },
+    { "corre", rfbEncodingCoRRE },
+    { "hextile", rfbEncodingHextile },
+    { "zlib", rfbEncodingZlib },
+    { "tight", rfbEncodingTight },
+    { "ultra", rfbEncodingUltra },
+    { "zrle", rfbEncodingZRLE },
+    { "zywrle", rfbEncodingZYWRLE },
+};
+
+#define KNOWN_ENCODINGS (int) (sizeof(knownEncodings) / sizeof(knownEncodings[0]))
+
+static const char* scenarios[] = { "static", "scroll", "video", "switch" };
+
+struct benchClient
+{
+    const encodingEntry* encoding;
+    rfbClientPtr cl;
+    int viewer; // our end of the connection, read and dropped
+    int64_t time;
+    int64_t bytes;
+};
+
+// settings
+static int width = 1080;
+static int height = 1920;
+static int frames = 120;
+static int scaling = 100;
+static int clientBpp = 32;
+static int quality = -1;
+static int compress = 1;
+static const char* scenario = NULL;
+static const char* framePath = NULL;
+
+static const encodingEntry* encodings[MAX_ENCODINGS];
+static int encodingCount = 0;
+
+static std::atomic<bool> draining(false);
+
+static int64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void printUsage()
+{
+    printf("\nvncd_bench [parameters] [frames.raw]\n"
+        "-W <width>\t- Frame width (1080)\n"
+        "-H <height>\t- Frame height (1920)\n"
+        "-g <scenario>\t- Synthetic content: static, scroll, video, switch (all)\n"
+        "-n <frames>\t- Frames per scenario (120)\n"
+        "-s <scale>\t- Scale percentage for the clients (100)\n"
+        "-f <bpp>\t- Pixel format of the clients: 32, 16 or 8 bits (32)\n"
+        "-q <quality>\t- JPEG quality level 0-9 for tight, -1 for lossless (-1)\n"
+        "-c <level>\t- Compression level 0-9 (1)\n"
+        "-e <list>\t- Comma separated encodings (raw,rre,corre,hextile,zlib,tight,ultra,zrle,zywrle)\n"
+        "-h\t\t- Print this help\n"
+        "\n"
+        "A frames file holds raw RGBX frames of the given size back to back,\n"
+        "or is a frame dump written by vncd -d.\n\n");
+}
+
+static bool parseEncodings(char* list)
+{
+    encodingCount = 0;
+    for (char* name = strtok(list, ","); name != NULL; name = strtok(NULL, ","))
+    {
+        const encodingEntry* found = NULL;
+        for (int i = 0; i < KNOWN_ENCODINGS; i++)
+        {
+            if (strcmp(knownEncodings[i].name, name) == 0) { found = &knownEncodings[i]; }
+        }
+
+        if (found == NULL || encodingCount == MAX_ENCODINGS)
+        {
+            fprintf(stderr, "Unknown encoding %s\n", name);
+            return false;
+        }
+
+        encodings[encodingCount++] = found;
+    }
+
+    return encodingCount > 0;
+}
+
+static bool parseArguments(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            framePath = argv[i];
+            continue;
+        }
+
+        if (argv[i][1] == 'h') { printUsage(); exit(0); }
+        if (i + 1 >= argc) { return false; }
+
+        char* value = argv[++i];
+        switch (argv[i - 1][1])
+        {
+            case 'W': width = atoi(value); break;
+            case 'H': height = atoi(value); break;
+            case 'g': scenario = value; break;
+            case 'n': frames = atoi(value); break;
+            case 's': scaling = atoi(value); break;
+            case 'f': clientBpp = atoi(value); break;
+            case 'q': quality = atoi(value); break;
+            case 'c': compress = atoi(value); break;
+            case 'e': if (!parseEncodings(value)) { return false; } break;
+            default: return false;
+        }
+    }
+
+    if (encodingCount == 0)
+    {
+        for (int i = 0; i < KNOWN_ENCODINGS; i++) { encodings[encodingCount++] = &knownEncodings[i]; }
+    }
+
+    return width > 0 && height > 0 && frames > 0 && scaling >= 1 && scaling <= 150 &&
+        (clientBpp == 32 || clientBpp == 16 || clientBpp == 8);
+}
+
+static rfbPixelFormat clientFormat()
+{
+    rfbPixelFormat format;
+    memset(&format, 0, sizeof(format));
+    format.bitsPerPixel = clientBpp;
+    format.trueColour = 1;
+
+    if (clientBpp == 32)
+    {
+        // same as the screen, nothing to convert
+        format.depth = 24;
+        format.redMax = format.greenMax = format.blueMax = 255;
+        format.redShift = 0;
+        format.greenShift = 8;
+        format.blueShift = 16;
+    }
+    else if (clientBpp == 16)
+    {
+        format.depth = 16;
+        format.redMax = 31;
+        format.greenMax = 63;
+        format.blueMax = 31;
+        format.redShift = 11;
+        format.greenShift = 5;
+        format.blueShift = 0;
+    }
+    else
+    {
+        format.depth = 8;
+        format.redMax = 7;
+        format.greenMax = 7;
+        format.blueMax = 3;
+        format.redShift = 0;
+        format.greenShift = 3;
+        format.blueShift = 6;
+    }
+
+    return format;
+}
+
+// a loopback TCP connection, so the encoders write to a real socket as in vncd
+static bool connectPair(int* server, int* viewer)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+
+    if (listener < 0 || bind(listener, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(listener, 1) != 0 ||
+        getsockname(listener, (struct sockaddr*) &addr, &length) != 0)
+    {
+        if (listener >= 0) { close(listener); }
+        return false;
+    }
+
+    *viewer = socket(AF_INET, SOCK_STREAM, 0);
+    if (*viewer < 0 || connect(*viewer, (struct sockaddr*) &addr, sizeof(addr)) != 0)
+    {
+        close(listener);
+        return false;
+    }
+
+    *server = accept(listener, NULL, NULL);
+    close(listener);
+    return *server >= 0;
+}
+
+static void drainViewers(benchClient* clients, int count)
+{
+    struct pollfd pfds[MAX_ENCODINGS];
+    for (int i = 0; i < count; i++) { pfds[i] = { clients[i].viewer, POLLIN, 0 }; }
+
+    char buffer[64 * 1024];
+    while (draining)
+    {
+        if (poll(pfds, count, 100) <= 0) { continue; }
+
+        for (int i = 0; i < count; i++)
+        {
+            if (pfds[i].revents & POLLIN) { read(pfds[i].fd, buffer, sizeof(buffer)); }
+        }
+    }
+}
+
+static bool addClient(rfbScreenInfoPtr screen, benchClient* client)
+{
+    int server;
+    if (!connectPair(&server, &client->viewer))
+    {
+        fprintf(stderr, "Failed connecting client for %s\n", client->encoding->name);
+        return false;
+    }
+
+    rfbClientPtr cl = rfbNewClient(screen, server);
+    if (cl == NULL) { return false; }
+
+    // skip the handshake, the viewer never answers
+    cl->state = rfbClientRec::RFB_NORMAL;
+    cl->preferredEncoding = client->encoding->encoding;
+    cl->tightQualityLevel = quality;
+    cl->tightCompressLevel = compress;
+    cl->zlibCompressLevel = compress;
+    cl->format = clientFormat();
+    rfbSetTranslateFunction(cl);
+
+    if (scaling != 100) { rfbScalingSetup(cl, width * scaling / 100, height * scaling / 100); }
+
+    client->cl = cl;
+    return true;
+}
+
+static void scaleRegion(rfbScreenInfoPtr screen, sraRegionPtr dirty)
+{
+    sraRect rect;
+    sraRectangleIterator* it = sraRgnGetIterator(dirty);
+    while (sraRgnIteratorNext(it, &rect)) { rfbScaledScreenUpdate(screen, rect.x1, rect.y1, rect.x2, rect.y2); }
+    sraRgnReleaseIterator(it);
+}
+
+// the encoders convert while encoding, this shows the share of the conversion alone
+static void convertRegion(rfbScreenInfoPtr screen, rfbClientPtr cl, sraRegionPtr dirty, char* output)
+{
+    sraRect rect;
+    sraRectangleIterator* it = sraRgnGetIterator(dirty);
+    while (sraRgnIteratorNext(it, &rect))
+    {
+        char* input = screen->frameBuffer + rect.y1 * screen->paddedWidthInBytes + rect.x1 * FRAME_BYTES_PER_PIXEL;
+        (*cl->translateFn)(cl->translateLookupTable, &screen->serverFormat, &cl->format, input, output,
+            screen->paddedWidthInBytes, rect.x2 - rect.x1, rect.y2 - rect.y1);
+    }
+    sraRgnReleaseIterator(it);
+}
+
+static void sendUpdate(benchClient* client, sraRegionPtr dirty)
+{
+    rfbClientPtr cl = client->cl;
+    sraRgnOr(cl->modifiedRegion, dirty);
+
+    sraRegionPtr requested = sraRgnCreateRect(0, 0, cl->scaledScreen->width, cl->scaledScreen->height);
+    sraRgnMakeEmpty(cl->requestedRegion);
+    sraRgnOr(cl->requestedRegion, requested);
+    sraRgnDestroy(requested);
+
+    int sent = rfbStatGetSentBytes(cl);
+    int64_t start = now();
+    rfbSendFramebufferUpdate(cl, cl->modifiedRegion);
+
+    client->time += now() - start;
+    client->bytes += rfbStatGetSentBytes(cl) - sent;
+}
+
+static int regionArea(sraRegionPtr region)
+{
+    int area = 0;
+    sraRect rect;
+    sraRectangleIterator* it = sraRgnGetIterator(region);
+    while (sraRgnIteratorNext(it, &rect)) { area += (rect.x2 - rect.x1) * (rect.y2 - rect.y1); }
+    sraRgnReleaseIterator(it);
+
+    return area;
+}
+
+static bool runScenario(const char* name, frameSource* source)
+{
+    size_t size = (size_t) width * height * FRAME_BYTES_PER_PIXEL;
+    uint8_t* frame = (uint8_t*) malloc(size);
+    uint8_t* previous = (uint8_t*) calloc(1, size);
+    char* converted = (char*) malloc(size);
+    if (frame == NULL || previous == NULL || converted == NULL)
+    {
+        fprintf(stderr, "Failed allocating frame buffers\n");
+        free(frame);
+        free(previous);
+        free(converted);
+        return false;
+    }
+
+    rfbScreenInfoPtr screen = rfbGetScreen(NULL, NULL, width, height, 8, 3, FRAME_BYTES_PER_PIXEL);
+    screen->frameBuffer = (char*) frame;
+    screen->serverFormat.redShift = 0;
+    screen->serverFormat.greenShift = 8;
+    screen->serverFormat.blueShift = 16;
+
+    benchClient clients[MAX_ENCODINGS];
+    memset(clients, 0, sizeof(clients));
+    int count = 0;
+    for (int i = 0; i < encodingCount; i++)
+    {
+        clients[count].encoding = encodings[i];
+        if (addClient(screen, &clients[count])) { count++; }
+    }
+
+    draining = true;
+    std::thread drainer(drainViewers, clients, count);
+
+    sraRegionPtr dirty = sraRgnCreate();
+    int64_t compareTime = 0;
+    int64_t scaleTime = 0;
+    int64_t convertTime = 0;
+    int64_t changedArea = 0;
+    int replayed = 0;
+
+    while (replayed < frames && nextFrame(source, frame))
+    {
+        int64_t start = now();
+        sraRgnMakeEmpty(dirty);
+        compareTiles(frame, previous, width, height, FRAME_BYTES_PER_PIXEL, dirty);
+        int64_t compared = now();
+        compareTime += compared - start;
+
+        if (scaling != 100) { scaleRegion(screen, dirty); }
+        int64_t scaled = now();
+        scaleTime += scaled - compared;
+
+        if (count > 0) { convertRegion(screen, clients[0].cl, dirty, converted); }
+        convertTime += now() - scaled;
+
+        changedArea += regionArea(dirty);
+        for (int i = 0; i < count; i++) { sendUpdate(&clients[i], dirty); }
+        replayed++;
+    }
+
+    draining = false;
+    drainer.join();
+
+    if (replayed > 0)
+    {
+        printf("%s: %d frames of %dx%d, %.1f%% changed per frame, clients at %d%% and %d bpp\n", name, replayed,
+            width, height, 100.0 * changedArea / replayed / width / height, scaling, clientBpp);
+        printf("  %-10s %10s %12s\n", "stage", "ms/frame", "bytes/frame");
+        printf("  %-10s %10.3f\n", "compare", compareTime / 1e6 / replayed);
+        printf("  %-10s %10.3f\n", "scale", scaleTime / 1e6 / replayed);
+        printf("  %-10s %10.3f\n", "convert", convertTime / 1e6 / replayed);
+        for (int i = 0; i < count; i++)
+        {
+            printf("  %-10s %10.3f %12lld\n", clients[i].encoding->name, clients[i].time / 1e6 / replayed,
+                (long long) (clients[i].bytes / replayed));
+        }
+        printf("\n");
+    }
+
+    sraRgnDestroy(dirty);
+    rfbScreenCleanup(screen);
+    for (int i = 0; i < count; i++) { close(clients[i].viewer); }
+    free(frame);
+    free(previous);
+    free(converted);
+
+    return replayed > 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (!parseArguments(argc, argv))
+    {
+        printUsage();
+        return 1;
+    }
+
+    rfbLogEnable(0);
+
+    bool success = true;
+    if (framePath != NULL)
+    {
+        frameSource* source = openFrameFile(framePath, &width, &height);
+        success = source != NULL && runScenario(framePath, source);
+        closeFrameSource(source);
+    }
+    else
+    {
+        int count = (scenario != NULL) ? 1 : sizeof(scenarios) / sizeof(scenarios[0]);
+        for (int i = 0; i < count; i++)
+        {
+            const char* name = (scenario != NULL) ? scenario : scenarios[i];
+            frameSource* source = openFrameScenario(name, width, height, frames);
+            success = source != NULL && runScenario(name, source) && success;
+            closeFrameSource(source);
+        }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("peak memory: %ld kB\n", usage.ru_maxrss);
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,322 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frames.h"
+#include "framefile.h"
+
+// system bars which stay in place on every screen (pixels)
+#define STATUS_BAR 72
+#define NAVIGATION_BAR 126
+
+// scrolled distance per frame (pixels)
+#define SCROLL_STEP 24
+
+// frames between two app switches
+#define SWITCH_INTERVAL 30
+
+// a page holds this many screens of content to scroll through
+#define PAGE_SCREENS 4
+
+enum scenarioType
+{
+    SCENARIO_FILE,
+    SCENARIO_DUMP,
+    SCENARIO_STATIC,
+    SCENARIO_SCROLL,
+    SCENARIO_VIDEO,
+    SCENARIO_SWITCH
+};
+
+struct frameSource
+{
+    scenarioType type;
+    int width;
+    int height;
+    int frames;
+    int index;
+
+    FILE* file;
+
+    // a vncd frame dump, its records are applied on top of each other
+    frameReader* reader;
+    uint8_t* dumped;
+
+    // two apps worth of content, the scroll scenario moves through the first
+    uint8_t* pages[2];
+    int pageHeight;
+};
+
+static uint32_t nextRandom(uint32_t* seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+static void fillRect(uint8_t* page, int width, int x1, int y1, int x2, int y2, uint32_t color)
+{
+    for (int y = y1; y < y2; y++)
+    {
+        uint32_t* row = (uint32_t*) (page + (size_t) y * width * FRAME_BYTES_PER_PIXEL);
+        for (int x = x1; x < x2; x++) { row[x] = color; }
+    }
+}
+
+// light background with lines of text-like glyphs and now and then a picture
+static uint8_t* createPage(int width, int height, uint32_t seed)
+{
+    uint8_t* page = (uint8_t*) malloc((size_t) width * height * FRAME_BYTES_PER_PIXEL);
+    if (page == NULL) { return NULL; }
+
+    uint32_t background = 0xFFFAFAFA - (nextRandom(&seed) & 0x000F0F0F);
+    fillRect(page, width, 0, 0, width, height, background);
+
+    int y = 16;
+    while (y + 48 < height)
+    {
+        if (nextRandom(&seed) % 8 == 0)
+        {
+            // picture with a smooth gradient
+            int h = 200 + nextRandom(&seed) % 300;
+            if (y + h > height) { break; }
+
+            uint32_t base = nextRandom(&seed);
+            for (int py = y; py < y + h; py++)
+            {
+                uint32_t* row = (uint32_t*) (page + (size_t) py * width * FRAME_BYTES_PER_PIXEL);
+                for (int px = 32; px < width - 32; px++)
+                {
+                    uint8_t r = (uint8_t) ((base & 0xFF) + px / 8);
+                    uint8_t g = (uint8_t) (((base >> 8) & 0xFF) + py / 8);
+                    uint8_t b = (uint8_t) (((base >> 16) & 0xFF) + (px + py) / 16);
+                    row[px] = 0xFF000000 | (b << 16) | (g << 8) | r;
+                }
+            }
+
+            y += h + 24;
+            continue;
+        }
+
+        // a line of words, each glyph a few dark strokes
+        int x = 32;
+        while (x < width - 64)
+        {
+            int letters = 2 + nextRandom(&seed) % 8;
+            for (int i = 0; i < letters && x < width - 64; i++)
+            {
+                int strokes = 1 + nextRandom(&seed) % 3;
+                for (int s = 0; s < strokes; s++)
+                {
+                    int sx = x + nextRandom(&seed) % 14;
+                    int sy = y + nextRandom(&seed) % 20;
+                    fillRect(page, width, sx, sy, sx + 3, sy + 4 + nextRandom(&seed) % 12, 0xFF303030);
+                }
+                x += 18;
+            }
+            x += 14;
+        }
+
+        y += 44;
+    }
+
+    return page;
+}
+
+// a frame dump written by vncd brings its own size
+static frameSource* openFrameDump(const char* path, int* width, int* height)
+{
+    frameReader* reader = openFrameReader(path);
+    if (reader == NULL)
+    {
+        fprintf(stderr, "Failed reading frame dump %s\n", path);
+        return NULL;
+    }
+
+    const frameFileHeader* format = getFrameFormat(reader);
+    if (format->bitsPerPixel != FRAME_BYTES_PER_PIXEL * 8)
+    {
+        fprintf(stderr, "Frame dump %s holds %d bpp frames, only %d are supported\n",
+            path, format->bitsPerPixel, FRAME_BYTES_PER_PIXEL * 8);
+        closeFrameReader(reader);
+        return NULL;
+    }
+
+    frameSource* source = (frameSource*) calloc(1, sizeof(frameSource));
+    source->type = SCENARIO_DUMP;
+    source->width = *width = format->width;
+    source->height = *height = format->height;
+    source->frames = getFrameCount(reader);
+    source->reader = reader;
+    source->dumped = (uint8_t*) calloc((size_t) format->width * format->height, FRAME_BYTES_PER_PIXEL);
+    if (source->dumped == NULL)
+    {
+        fprintf(stderr, "Failed allocating frame dump content\n");
+        closeFrameSource(source);
+        return NULL;
+    }
+
+    return source;
+}
+
+frameSource* openFrameFile(const char* path, int* width, int* height)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Failed opening %s\n", path);
+        return NULL;
+    }
+
+    char magic[sizeof(((frameFileHeader*) 0)->magic)];
+    if (fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, FRAME_FILE_MAGIC, sizeof(magic)) == 0)
+    {
+        fclose(file);
+        return openFrameDump(path, width, height);
+    }
+    rewind(file);
+
+    frameSource* source = (frameSource*) calloc(1, sizeof(frameSource));
+    source->type = SCENARIO_FILE;
+    source->width = *width;
+    source->height = *height;
+    source->file = file;
+    return source;
+}
+
+frameSource* openFrameScenario(const char* scenario, int width, int height, int frames)
+{
+    scenarioType type;
+    if (strcmp(scenario, "static") == 0) { type = SCENARIO_STATIC; }
+    else if (strcmp(scenario, "scroll") == 0) { type = SCENARIO_SCROLL; }
+    else if (strcmp(scenario, "video") == 0) { type = SCENARIO_VIDEO; }
+    else if (strcmp(scenario, "switch") == 0) { type = SCENARIO_SWITCH; }
+    else
+    {
+        fprintf(stderr, "Unknown scenario %s\n", scenario);
+        return NULL;
+    }
+
+    frameSource* source = (frameSource*) calloc(1, sizeof(frameSource));
+    source->type = type;
+    source->width = width;
+    source->height = height;
+    source->frames = frames;
+    source->pageHeight = height * PAGE_SCREENS;
+    source->pages[0] = createPage(width, source->pageHeight, 1);
+    source->pages[1] = createPage(width, source->pageHeight, 2);
+    if (source->pages[0] == NULL || source->pages[1] == NULL)
+    {
+        fprintf(stderr, "Failed allocating scenario content\n");
+        closeFrameSource(source);
+        return NULL;
+    }
+
+    return source;
+}
+
+static void drawBars(frameSource* source, uint8_t* frame)
+{
+    fillRect(frame, source->width, 0, 0, source->width, STATUS_BAR, 0xFF202020);
+    fillRect(frame, source->width, 0, source->height - NAVIGATION_BAR, source->width, source->height, 0xFF000000);
+}
+
+// plasma-like moving colors with some grain, hard for every encoding
+static void drawVideo(frameSource* source, uint8_t* frame)
+{
+    int width = source->width;
+    int videoHeight = width * 9 / 16;
+    int top = (source->height - videoHeight) / 2;
+    uint32_t seed = source->index + 1;
+    int t = source->index * 3;
+
+    for (int y = 0; y < videoHeight; y++)
+    {
+        uint32_t* row = (uint32_t*) (frame + (size_t) (top + y) * width * FRAME_BYTES_PER_PIXEL);
+        for (int x = 0; x < width; x++)
+        {
+            uint8_t grain = nextRandom(&seed) & 0x0F;
+            uint8_t r = (uint8_t) (x + t + grain);
+            uint8_t g = (uint8_t) (y * 2 - t + grain);
+            uint8_t b = (uint8_t) ((x + y) / 2 + t * 2);
+            row[x] = 0xFF000000 | (b << 16) | (g << 8) | r;
+        }
+    }
+}
+
+bool nextFrame(frameSource* source, uint8_t* frame)
+{
+    size_t size = (size_t) source->width * source->height * FRAME_BYTES_PER_PIXEL;
+    if (source->type == SCENARIO_FILE)
+    {
+        source->index++;
+        return fread(frame, 1, size, source->file) == size;
+    }
+
+    if (source->type == SCENARIO_DUMP)
+    {
+        if (source->index >= source->frames) { return false; }
+        if (!applyFrame(source->reader, source->index, source->dumped, NULL))
+        {
+            fprintf(stderr, "Frame %d of the dump is damaged\n", source->index);
+            return false;
+        }
+
+        memcpy(frame, source->dumped, size);
+        source->index++;
+        return true;
+    }
+
+    if (source->index >= source->frames) { return false; }
+
+    int page = 0;
+    int offset = 0;
+    if (source->type == SCENARIO_SCROLL)
+    {
+        // back and forth through the page
+        int range = source->pageHeight - source->height;
+        int position = (source->index * SCROLL_STEP) % (2 * range);
+        offset = (position < range) ? position : 2 * range - position;
+    }
+    else if (source->type == SCENARIO_SWITCH)
+    {
+        page = (source->index / SWITCH_INTERVAL) % 2;
+    }
+
+    memcpy(frame, source->pages[page] + (size_t) offset * source->width * FRAME_BYTES_PER_PIXEL, size);
+    if (source->type == SCENARIO_VIDEO) { drawVideo(source, frame); }
+    drawBars(source, frame);
+
+    source->index++;
+    return true;
+}
+
+void closeFrameSource(frameSource* source)
+{
+    if (source == NULL) { return; }
+
+    if (source->file != NULL) { fclose(source->file); }
+    if (source->reader != NULL) { closeFrameReader(source->reader); }
+    free(source->dumped);
+    free(source->pages[0]);
+    free(source->pages[1]);
+    free(source);
+}
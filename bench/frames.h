@@ -0,0 +1,41 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <stdint.h>
+
+// frames are 32-bit RGBX like the usual RGBA_8888 screen of a device
+#define FRAME_BYTES_PER_PIXEL 4
+
+struct frameSource;
+
+// a file holding raw frames back to back, e.g. collected with "screencap" without header,
+// or a frame dump of vncd, which sets the size
+frameSource* openFrameFile(const char* path, int* width, int* height);
+
+// synthetic content for a scenario: static, scroll, video or switch
+frameSource* openFrameScenario(const char* scenario, int width, int height, int frames);
+
+// false once the source ran out of frames
+bool nextFrame(frameSource* source, uint8_t* frame);
+void closeFrameSource(frameSource* source);
+
+#endif
@@ -44,8 +44,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <linux/input.h>
 
 #include <android/log.h>
-#define L(...) do { __android_log_print(ANDROID_LOG_DEBUG, "vncd", __VA_ARGS__); printf(__VA_ARGS__); } while (0)
+#include "log.h"
 
-void setIdle(int i);
+void startCaptureBurst();
 
 #endif
@@ -0,0 +1,197 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <poll.h>
+#include <stdarg.h>
+#include <sys/eventfd.h>
+
+#include <thread>
+
+#include "common.h"
+
+// messages the ring holds, a power of two
+#define LOG_SLOTS 256
+
+// longer messages are truncated
+#define LOG_MESSAGE 1020
+
+struct logSlot
+{
+    std::atomic<uint32_t> sequence; // tells producers and the consumer whose turn it is
+    int level;
+    char text[LOG_MESSAGE];
+};
+
+static logSlot slots[LOG_SLOTS];
+
+// bounded multi-producer queue after Dmitry Vyukov, with a single consumer
+static std::atomic<uint32_t> enqueuePos(0);
+static uint32_t dequeuePos = 0;
+static std::atomic<uint32_t> dropped(0);
+
+static std::atomic<bool> running(false);
+static std::atomic<bool> sleeping(false);
+static std::thread drainThread;
+static int wakeupFd = -1;
+
+std::atomic<int> logLevel(LOG_INFO);
+
+static const int priorities[] = {
+    ANDROID_LOG_ERROR, ANDROID_LOG_WARN, ANDROID_LOG_INFO, ANDROID_LOG_DEBUG, ANDROID_LOG_VERBOSE
+};
+
+// messages may be logged before main() started the thread
+__attribute__((constructor)) static void prepareSlots()
+{
+    for (uint32_t i = 0; i < LOG_SLOTS; i++) { slots[i].sequence.store(i, std::memory_order_relaxed); }
+}
+
+void logMessage(int level, const char* format, ...)
+{
+    logSlot* slot;
+    uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+    while (true)
+    {
+        slot = &slots[pos % LOG_SLOTS];
+        int32_t diff = (int32_t) (slot->sequence.load(std::memory_order_acquire) - pos);
+        if (diff == 0)
+        {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) { break; }
+        }
+        else if (diff < 0)
+        {
+            // the consumer is behind, dropping is better than waiting for it
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(slot->text, LOG_MESSAGE, format, args);
+    va_end(args);
+    slot->level = level;
+
+    // sequentially consistent, so either the consumer sees the message or we see it sleeping
+    slot->sequence.store(pos + 1);
+
+    if (sleeping.load() && sleeping.exchange(false))
+    {
+        uint64_t wakeup = 1;
+        write(wakeupFd, &wakeup, sizeof(wakeup));
+    }
+}
+
+static bool writeNext()
+{
+    logSlot* slot = &slots[dequeuePos % LOG_SLOTS];
+    if (slot->sequence.load(std::memory_order_acquire) != dequeuePos + 1) { return false; }
+
+    __android_log_print(priorities[slot->level], "vncd", "%s", slot->text);
+    fputs(slot->text, stdout);
+
+    // hand the slot back to the producers for the next round
+    slot->sequence.store(dequeuePos + LOG_SLOTS, std::memory_order_release);
+    dequeuePos++;
+    return true;
+}
+
+static void drain()
+{
+    while (writeNext()) {}
+    fflush(stdout);
+
+    uint32_t lost = dropped.exchange(0, std::memory_order_relaxed);
+    if (lost > 0)
+    {
+        __android_log_print(ANDROID_LOG_WARN, "vncd", "%u log messages dropped\n", lost);
+        printf("%u log messages dropped\n", lost);
+    }
+}
+
+static void waitForMessages()
+{
+    sleeping = true;
+
+    // a message might have been published before the flag was visible
+    if (slots[dequeuePos % LOG_SLOTS].sequence.load() == dequeuePos + 1)
+    {
+        sleeping = false;
+        return;
+    }
+
+    struct pollfd pfd = { wakeupFd, POLLIN, 0 };
+    if (poll(&pfd, 1, -1) > 0)
+    {
+        uint64_t wakeups;
+        read(wakeupFd, &wakeups, sizeof(wakeups));
+    }
+
+    sleeping = false;
+}
+
+static void logThread()
+{
+    while (running)
+    {
+        drain();
+        waitForMessages();
+    }
+}
+
+void initLog(void)
+{
+    wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeupFd < 0)
+    {
+        // without the thread, messages are written on flushes only
+        printf("Failed creating log wakeup event (errno %d)\n", errno);
+        return;
+    }
+
+    running = true;
+    drainThread = std::thread(logThread);
+
+    // whatever is still queued gets written on exit()
+    atexit(flushLog);
+}
+
+void setLogLevel(int level)
+{
+    if (level < LOG_ERROR) { level = LOG_ERROR; }
+    if (level > LOG_LEVEL_MAX) { level = LOG_LEVEL_MAX; }
+    logLevel = level;
+}
+
+// writes all queued messages, the background thread is stopped for that
+void flushLog(void)
+{
+    if (running.exchange(false))
+    {
+        uint64_t wakeup = 1;
+        write(wakeupFd, &wakeup, sizeof(wakeup));
+        drainThread.join();
+    }
+
+    drain();
+}
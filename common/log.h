@@ -0,0 +1,53 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+
+#define LOG_ERROR   0
+#define LOG_WARN    1
+#define LOG_INFO    2
+#define LOG_DEBUG   3
+#define LOG_VERBOSE 4
+
+// messages above this level are not even compiled in
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX LOG_DEBUG
+#endif
+
+// messages are formatted into a ring buffer and written by a background thread,
+// so logging never blocks the caller; they are dropped if the ring is full
+extern std::atomic<int> logLevel;
+void logMessage(int level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+#define LOG_AT(level, ...) do { if ((level) <= LOG_LEVEL_MAX && (level) <= logLevel.load(std::memory_order_relaxed)) { logMessage(level, __VA_ARGS__); } } while (0)
+
+#define LE(...) LOG_AT(LOG_ERROR, __VA_ARGS__)
+#define LW(...) LOG_AT(LOG_WARN, __VA_ARGS__)
+#define L(...)  LOG_AT(LOG_INFO, __VA_ARGS__)
+#define LD(...) LOG_AT(LOG_DEBUG, __VA_ARGS__)
+#define LV(...) LOG_AT(LOG_VERBOSE, __VA_ARGS__)
+
+void initLog(void);
+void setLogLevel(int level);
+void flushLog(void);
+
+#endif
@@ -0,0 +1,55 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include <cutils/trace.h>
+
+// events go to the kernel trace_marker in the atrace format, next to the ones of
+// SurfaceFlinger; they are recorded whenever the gfx category is traced, e.g. with
+// "atrace gfx" or a Perfetto config listing it, and cost a flag check otherwise
+#define TRACE_TAG ATRACE_TAG_GRAPHICS
+
+static inline bool isTracing(void) { return atrace_is_tag_enabled(TRACE_TAG) != 0; }
+
+static inline void traceBegin(const char* name) { atrace_begin(TRACE_TAG, name); }
+static inline void traceEnd(void) { atrace_end(TRACE_TAG); }
+
+// async events may end on another thread, the cookie tells overlapping ones apart
+static inline void traceAsyncBegin(const char* name, int32_t cookie) { atrace_async_begin(TRACE_TAG, name, cookie); }
+static inline void traceAsyncEnd(const char* name, int32_t cookie) { atrace_async_end(TRACE_TAG, name, cookie); }
+
+static inline void traceCounter(const char* name, int32_t value) { atrace_int(TRACE_TAG, name, value); }
+
+// slice covering the rest of the enclosing block
+class traceScope
+{
+public:
+    traceScope(const char* name) { traceBegin(name); }
+    ~traceScope() { traceEnd(); }
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) traceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif
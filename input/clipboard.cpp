@@ -1,20 +1,113 @@
+#include <sys/eventfd.h>
+#include <android/api-level.h>
+
+#include <mutex>
+#include <thread>
+
+#include <binder/Binder.h>
 #include <binder/IServiceManager.h>
 #include <binder/MemoryBase.h>
 #include <binder/Parcel.h>
 #include <utils/String16.h>
+#include <utils/String8.h>
 
 #include "common.h"
 #include "clipboard.h"
 
 using namespace android;
 
+// methods of IClipboard up to Android 11, see getTransaction()
+enum {
+    SET_PRIMARY_CLIP = 0,
+    GET_PRIMARY_CLIP = 2,
+    ADD_PRIMARY_CLIP_CHANGED_LISTENER = 5
+};
+
 enum {
-    SET_PRIMARY_CLIP = IBinder::FIRST_CALL_TRANSACTION
+    DISPATCH_PRIMARY_CLIP_CHANGED = IBinder::FIRST_CALL_TRANSACTION
 };
 
+#define CLIPBOARD_INTERFACE "android.content.IClipboard"
+#define LISTENER_INTERFACE "android.content.IOnPrimaryClipChangedListener"
+
+// the shell may read the clipboard in the background, root is not checked against it
+#define CALLING_PACKAGE "com.android.shell"
+
+// items of a clip we are willing to look at
+#define MAX_ITEMS 1024
+
+// the ClipDescription parcel grew over the releases
+#define API_CLIP_TIMESTAMP 26      // Android 8 appends the time the clip was set
+#define API_CLIP_CLASSIFICATION 31 // Android 12 appends the text classification
+
+// Android 12 appends the activity and the text links to an item
+#define API_CLIP_ITEM_LINKS 31
+
+// Android 12 inserts setPrimaryClipAsPackage after setPrimaryClip
+// and passes an attribution tag along with the calling package
+#define API_CLIP_AS_PACKAGE 31
+
+// newest release whose interface is known, Android 14 adds a device id to every call
+#define API_CLIPBOARD_MAX 33
+
+// interval of looking for a restarted clipboard service (s)
+#define SERVICE_RETRY 1
+
+// default state of a clip nobody classified yet
+#define CLASSIFICATION_NOT_COMPLETE 1
+
+static std::mutex serviceLock;
+static sp<IBinder> service;
+
+// latest text on the device clipboard, and whether the clients still need to hear of it
+static std::mutex pendingLock;
+static String16 deviceText;
+static bool hasPending = false;
+static int pendingFd = -1;
+
+// hash of the text last exchanged in either direction, so nothing is sent back
+static uint64_t lastHash = 0;
+
+static uint64_t hashText(const String16& text)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    const char16_t* data = text.string();
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+// returns false if the same text was exchanged already
+static bool rememberText(const String16& text)
+{
+    std::lock_guard<std::mutex> lock(pendingLock);
+
+    uint64_t hash = hashText(text);
+    if (hash == lastHash) { return false; }
+
+    lastHash = hash;
+    return true;
+}
+
+static int getApiLevel()
+{
+    static int level = android_get_device_api_level();
+    return level;
+}
+
+static uint32_t getTransaction(int method)
+{
+    if (method > SET_PRIMARY_CLIP && getApiLevel() >= API_CLIP_AS_PACKAGE) { method++; }
+    return IBinder::FIRST_CALL_TRANSACTION + method;
+}
+
 void writeToken(Parcel& data)
 {
-    data.writeInterfaceToken(String16("android.content.IClipboard")); // interface name
+    data.writeInterfaceToken(String16(CLIPBOARD_INTERFACE)); // interface name
     data.writeInt32(1); // clip count
 }
 
@@ -24,6 +117,18 @@ void writeDescription(Parcel& data)
     data.writeString16(String16("vnc")); // label text
     data.writeInt32(0); // array of mime types
     data.writeInt32(-1); // extras bundle
+
+    if (getApiLevel() >= API_CLIP_TIMESTAMP)
+    {
+        data.writeInt64(0); // timestamp, set by the service
+    }
+
+    if (getApiLevel() >= API_CLIP_CLASSIFICATION)
+    {
+        data.writeInt32(0); // not styled
+        data.writeInt32(CLASSIFICATION_NOT_COMPLETE);
+        data.writeInt32(0); // empty bundle of entity confidences
+    }
 }
 
 void writeIcon(Parcel& data)
@@ -31,33 +136,315 @@ void writeIcon(Parcel& data)
     data.writeInt32(0); // no icon
 }
 
-void writeContent(Parcel& data, int len, char* str)
+void writeContent(Parcel& data, const String16& text)
 {
     data.writeInt32(1); // item count
     data.writeInt32(1); // content kind
-    data.writeString16(String16(str, len)); // content text
+    data.writeString16(text); // content text
+
+    // the arguments of the call follow, so the item has to be complete
+    data.writeInt32(-1); // no HTML text
+    data.writeInt32(0); // no intent
+    data.writeInt32(0); // no uri
+
+    if (getApiLevel() >= API_CLIP_ITEM_LINKS)
+    {
+        data.writeInt32(0); // no activity info
+        data.writeInt32(0); // no text links
+    }
 }
 
-void setClipboard(int len, char* str)
+void writeCaller(Parcel& data)
+{
+    data.writeString16(String16(CALLING_PACKAGE));
+    if (getApiLevel() >= API_CLIP_AS_PACKAGE)
+    {
+        data.writeInt32(-1); // no attribution tag
+    }
+    data.writeInt32(0); // user id
+}
+
+static void readChangedClip(const sp<IBinder>& binder);
+static void reconnectService();
+
+class ClipboardListener : public BBinder
+{
+    status_t onTransact(uint32_t code, const Parcel& data, Parcel* reply, uint32_t flags) override
+    {
+        if (code != DISPATCH_PRIMARY_CLIP_CHANGED) { return BBinder::onTransact(code, data, reply, flags); }
+        if (!data.enforceInterface(String16(LISTENER_INTERFACE))) { return PERMISSION_DENIED; }
+
+        // runs on a binder thread, the clip is fetched right here
+        std::unique_lock<std::mutex> lock(serviceLock);
+        sp<IBinder> binder = service;
+        lock.unlock();
+
+        if (binder != NULL) { readChangedClip(binder); }
+        return NO_ERROR;
+    }
+};
+
+class ClipboardDeath : public IBinder::DeathRecipient
 {
+    void binderDied(const wp<IBinder>& who) override
+    {
+        LW("Clipboard service died\n");
+
+        std::unique_lock<std::mutex> lock(serviceLock);
+        service.clear();
+        lock.unlock();
+
+        // changes on the device are only heard of again once the listener is back
+        std::thread(reconnectService).detach();
+    }
+};
+
+static sp<ClipboardListener> listener;
+static sp<ClipboardDeath> death;
+
+static void addListener(const sp<IBinder>& binder)
+{
+    Parcel data, reply;
+    data.writeInterfaceToken(String16(CLIPBOARD_INTERFACE));
+    data.writeStrongBinder(listener);
+    writeCaller(data);
+
+    status_t result = binder->transact(getTransaction(ADD_PRIMARY_CLIP_CHANGED_LISTENER), data, &reply);
+    if (result != NO_ERROR || reply.readExceptionCode() != 0)
+    {
+        LE("Failed listening to clipboard changes\n");
+    }
+}
+
+// the service is looked up once and dropped again when it dies,
+// it is left alone unless initClipboard() knew the interface
+static sp<IBinder> getService()
+{
+    std::lock_guard<std::mutex> lock(serviceLock);
+    if (service != NULL || listener == NULL) { return service; }
+
     sp<IServiceManager> sm = defaultServiceManager();
-    sp<IBinder> binder = sm->checkService(String16("clipboard"));
-    if (binder == NULL)
+    service = sm->checkService(String16("clipboard"));
+    if (service == NULL)
+    {
+        LE("No clipboard service found\n");
+        return NULL;
+    }
+
+    service->linkToDeath(death);
+    if (listener != NULL) { addListener(service); }
+
+    return service;
+}
+
+// looks up the service and adds the listener as soon as the service is back
+static void reconnectService()
+{
+    while (defaultServiceManager()->checkService(String16("clipboard")) == NULL) { sleep(SERVICE_RETRY); }
+
+    sp<IBinder> binder = getService();
+    if (binder == NULL) { return; }
+
+    // the clip of the new service is news to the clients
+    L("Clipboard service is back\n");
+    readChangedClip(binder);
+}
+
+static bool skipLabel(const Parcel& reply)
+{
+    // spanned labels are followed by their spans, which are not worth parsing
+    if (reply.readInt32() != 1) { return false; }
+
+    reply.readString16();
+    return true;
+}
+
+// bundles are preceded by their length, which does not cover the magic in front of the data
+static void skipBundle(const Parcel& reply)
+{
+    int length = reply.readInt32();
+    if (length > 0) { reply.setDataPosition(reply.dataPosition() + sizeof(int32_t) + length); }
+}
+
+static bool readItems(const Parcel& reply, String16* text)
+{
+    if (reply.readInt32() != 0) { return false; } // icon
+
+    int count = reply.readInt32();
+    if (count < 1 || count > MAX_ITEMS) { return false; }
+
+    // the first item is the one pasted by apps
+    int kind = reply.readInt32();
+    if (kind != 0 && kind != 1) { return false; }
+
+    *text = reply.readString16();
+    return true;
+}
+
+static bool readClipText(const Parcel& reply, String16* text)
+{
+    if (reply.readExceptionCode() != 0) { return false; }
+    if (reply.readInt32() == 0) { return false; } // no clip
+
+    if (!skipLabel(reply)) { return false; }
+
+    int mimeTypes = reply.readInt32();
+    for (int i = 0; i < mimeTypes; i++) { reply.readString16(); }
+    skipBundle(reply); // extras
+
+    if (getApiLevel() >= API_CLIP_TIMESTAMP) { reply.readInt64(); }
+    if (getApiLevel() >= API_CLIP_CLASSIFICATION)
+    {
+        reply.readInt32(); // styled
+        reply.readInt32(); // classification status
+        skipBundle(reply); // entity confidences
+    }
+
+    return readItems(reply, text);
+}
+
+static void readChangedClip(const sp<IBinder>& binder)
+{
+    Parcel data, reply;
+    data.writeInterfaceToken(String16(CLIPBOARD_INTERFACE));
+    writeCaller(data);
+
+    status_t result = binder->transact(getTransaction(GET_PRIMARY_CLIP), data, &reply);
+    if (result != NO_ERROR)
     {
-        L("No clipboard service found\n");
+        LE("Failed reading clipboard\n");
         return;
     }
 
+    String16 text;
+    if (!readClipText(reply, &text) || text.size() == 0) { return; }
+    bool changed = rememberText(text);
+
+    std::lock_guard<std::mutex> lock(pendingLock);
+    deviceText = text;
+    if (!changed) { return; }
+    hasPending = true;
+
+    uint64_t signal = 1;
+    write(pendingFd, &signal, sizeof(signal));
+}
+
+static bool transactClipboard(const String16& text, uint32_t flags)
+{
+    sp<IBinder> binder = getService();
+    if (binder == NULL) { return false; }
+
+    // viewers echo back what they were sent, which must not replace and restamp the
+    // device clip; the change notification for new text must not reach the clients
+    if (!rememberText(text)) { return true; }
+
+    std::unique_lock<std::mutex> lock(pendingLock);
+    deviceText = text;
+    lock.unlock();
+
     Parcel data, reply;
     writeToken(data);
     writeDescription(data);
     writeIcon(data);
-    writeContent(data, len, str);
+    writeContent(data, text);
+    writeCaller(data);
 
-    status_t result = binder->transact(SET_PRIMARY_CLIP, data, &reply, IBinder::FLAG_ONEWAY);
+    status_t result = binder->transact(getTransaction(SET_PRIMARY_CLIP), data, &reply, flags);
     if (result != NO_ERROR)
     {
-        L("Clipboard transaction failed\n");
-        return;
+        LE("Clipboard transaction failed\n");
+        return false;
+    }
+
+    return true;
+}
+
+int initClipboard(void)
+{
+    // calls in an unknown layout might end up as clearPrimaryClip or worse
+    if (getApiLevel() > API_CLIPBOARD_MAX)
+    {
+        LE("Clipboard sharing is not supported on API level %d\n", getApiLevel());
+        return -1;
+    }
+
+    pendingFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pendingFd < 0)
+    {
+        LE("Failed creating clipboard event (errno %d)\n", errno);
+        return -1;
     }
+
+    listener = new ClipboardListener();
+    death = new ClipboardDeath();
+
+    // registers the listener as well
+    getService();
+    return pendingFd;
+}
+
+// text from extended clipboard clients is UTF-8
+void setClipboard(int len, char* str)
+{
+    transactClipboard(String16(str, len), IBinder::FLAG_ONEWAY);
+}
+
+// classic cut text is Latin-1, which maps directly onto UTF-16
+void setClipboardLatin1(int len, const char* str)
+{
+    char16_t* chars = (char16_t*) malloc(len * sizeof(char16_t));
+    if (chars == NULL) { return; }
+
+    for (int i = 0; i < len; i++) { chars[i] = (uint8_t) str[i]; }
+    transactClipboard(String16(chars, len), IBinder::FLAG_ONEWAY);
+    free(chars);
+}
+
+// returns once the clipboard service applied the new content
+bool setClipboardSync(int len, const char* str)
+{
+    return transactClipboard(String16(str, len), 0);
+}
+
+// true if the device clipboard changed since the last call
+bool takeClipboardChange(void)
+{
+    uint64_t signals;
+    read(pendingFd, &signals, sizeof(signals));
+
+    std::lock_guard<std::mutex> lock(pendingLock);
+    bool changed = hasPending;
+    hasPending = false;
+    return changed;
+}
+
+// returns a copy of the device clipboard as UTF-8 or as Latin-1 for classic clients,
+// characters beyond Latin-1 are replaced
+char* getClipboardText(int* len, bool utf8)
+{
+    std::lock_guard<std::mutex> lock(pendingLock);
+
+    if (utf8)
+    {
+        String8 converted(deviceText);
+        char* text = (char*) malloc(converted.length() + 1);
+        if (text == NULL) { return NULL; }
+
+        memcpy(text, converted.string(), converted.length() + 1);
+        *len = converted.length();
+        return text;
+    }
+
+    char* text = (char*) malloc(deviceText.size() + 1);
+    if (text == NULL) { return NULL; }
+
+    const char16_t* data = deviceText.string();
+    for (size_t i = 0; i < deviceText.size(); i++)
+    {
+        text[i] = (data[i] <= 0xFF) ? (char) data[i] : '?';
+    }
+    text[deviceText.size()] = 0;
+
+    *len = deviceText.size();
+    return text;
 }
@@ -1,6 +1,11 @@
 #ifndef CLIPBOARD_H
 #define CLIPBOARD_H
 
+int initClipboard(void);
 void setClipboard(int len, char* str);
+void setClipboardLatin1(int len, const char* str);
+bool setClipboardSync(int len, const char* str);
+bool takeClipboardChange(void);
+char* getClipboardText(int* len, bool utf8);
 
 #endif
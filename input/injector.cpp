@@ -0,0 +1,397 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+
+#include <atomic>
+#include <thread>
+
+#include <utils/Timers.h>
+
+#include "common.h"
+#include "clipboard.h"
+#include "events.h"
+#include "injector.h"
+#include "metrics.h"
+#include "trace.h"
+
+// number of batches the RFB thread may be ahead of uinput
+#define QUEUE_SIZE 128
+
+// how long to wait before writing again into a busy device (us)
+#define RETRY_DELAY 1000
+
+// batches waiting longer than this are reported (ms)
+#define QUEUE_WARNING 50
+
+// initial number of batches held back while the queue is full
+#define OVERFLOW_SIZE 16
+
+struct queuedBatch
+{
+    nsecs_t queued;
+    char* text; // put on the clipboard before the events are written
+    int textLength;
+    int count;
+    struct input_event events[SUINPUT_BATCH_SIZE];
+};
+
+static queuedBatch queue[QUEUE_SIZE];
+
+// head is only written by the producer, tail only by the consumer
+static std::atomic<uint32_t> head(0);
+static std::atomic<uint32_t> tail(0);
+
+// the newest pointer motion not yet written, older ones are dropped
+static queuedBatch motion;
+static bool hasMotion = false;
+static nsecs_t lastMotion = 0;
+static std::atomic<nsecs_t> refreshPeriod(ms2ns(16));
+static std::atomic<nsecs_t> lastWrite(0);
+static uint32_t coalesced = 0;
+
+// batches which did not fit into the queue, only used by the producer;
+// they go first once the consumer made room and woke up the event loop
+static queuedBatch* overflow = NULL;
+static int overflowStart = 0;
+static int overflowCount = 0;
+static int overflowCapacity = 0;
+static std::atomic<bool> overflowing(false);
+
+static std::atomic<bool> running(false);
+static std::atomic<bool> sleeping(false);
+static int wakeupFd = -1;
+static int inputFd = -1;
+
+static bool writeEvents(struct input_event* events, int count)
+{
+    TRACE_SCOPE("vncd:inject");
+
+    // every event of a batch happened at the same moment
+    struct timeval now;
+    gettimeofday(&now, 0);
+    for (int i = 0; i < count; i++) { events[i].time = now; }
+
+    uint8_t* data = (uint8_t*) events;
+    size_t size = count * sizeof(struct input_event);
+    while (size > 0 && running)
+    {
+        ssize_t written = write(inputFd, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR) { continue; }
+            if (errno == EAGAIN) { usleep(RETRY_DELAY); continue; }
+
+            LE("Failed injecting input events (errno %d)\n", errno);
+            return false;
+        }
+
+        // uinput only accepts whole events
+        data += written;
+        size -= written;
+    }
+
+    lastWrite = systemTime(SYSTEM_TIME_MONOTONIC);
+    countMetric(METRIC_INPUT_EVENTS, count);
+    return true;
+}
+
+// waits until something is queued or the timeout (ns) passed, -1 waits forever
+static void waitForInput(nsecs_t timeout)
+{
+    sleeping = true;
+
+    // the producer might have queued something before it saw the flag
+    if (head.load() != tail.load(std::memory_order_relaxed))
+    {
+        sleeping = false;
+        return;
+    }
+
+    struct pollfd pfd = { wakeupFd, POLLIN, 0 };
+    int ms = (timeout < 0) ? -1 : (int) ns2ms(timeout + ms2ns(1) - 1);
+    if (poll(&pfd, 1, ms) > 0)
+    {
+        uint64_t wakeups;
+        read(wakeupFd, &wakeups, sizeof(wakeups));
+    }
+
+    sleeping = false;
+}
+
+// a complete report which only moves the pointer, without any button or key transition,
+// new or lifted contacts show up as tracking id changes
+static bool isMotion(const struct input_event* events, int count)
+{
+    if (count == 0 || events[count - 1].type != EV_SYN) { return false; }
+
+    for (int i = 0; i < count; i++)
+    {
+        const struct input_event* event = &events[i];
+        if (event->type != EV_ABS && event->type != EV_SYN) { return false; }
+        if (event->type == EV_ABS && event->code == ABS_MT_TRACKING_ID) { return false; }
+    }
+
+    return true;
+}
+
+static void writeMotion(nsecs_t now)
+{
+    if (!hasMotion) { return; }
+
+    writeEvents(motion.events, motion.count);
+    hasMotion = false;
+    lastMotion = now;
+}
+
+static void injectBatch(queuedBatch* entry, nsecs_t now)
+{
+    if (entry->text == NULL && isMotion(entry->events, entry->count))
+    {
+        // the display shows at most one position per refresh anyway
+        if (hasMotion) { coalesced++; }
+        memcpy(&motion, entry, sizeof(queuedBatch));
+        hasMotion = true;
+
+        if (now - lastMotion >= refreshPeriod) { writeMotion(now); }
+        return;
+    }
+
+    // transitions keep their exact order, so the motion before goes first
+    writeMotion(now);
+
+    // the paste shortcut may only follow once the clipboard holds the text
+    if (entry->text != NULL)
+    {
+        setClipboardSync(entry->textLength, entry->text);
+        free(entry->text);
+        entry->text = NULL;
+    }
+
+    writeEvents(entry->events, entry->count);
+}
+
+static void injectorThread()
+{
+    while (running)
+    {
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        uint32_t current = tail.load(std::memory_order_relaxed);
+        if (current == head.load(std::memory_order_acquire))
+        {
+            if (hasMotion && now - lastMotion >= refreshPeriod)
+            {
+                writeMotion(now);
+                continue;
+            }
+
+            waitForInput(hasMotion ? lastMotion + refreshPeriod - now : -1);
+            continue;
+        }
+
+        queuedBatch* entry = &queue[current % QUEUE_SIZE];
+        nsecs_t delay = now - entry->queued;
+        if (delay > ms2ns(QUEUE_WARNING))
+        {
+            LW("Input injection delayed by %d ms\n", (int) ns2ms(delay));
+        }
+
+        injectBatch(entry, now);
+
+        // sequentially consistent, so either the producer sees the room or we see its overflow
+        tail.store(current + 1);
+        if (overflowing) { wakeEvents(); }
+    }
+
+    L("Input injection stopped, %u pointer motions coalesced\n", coalesced);
+}
+
+int initInjector(int uinput_fd)
+{
+    wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeupFd < 0)
+    {
+        LE("Failed creating input wakeup event (errno %d)\n", errno);
+        return -1;
+    }
+
+    inputFd = uinput_fd;
+    running = true;
+    std::thread(injectorThread).detach();
+
+    return 0;
+}
+
+static void fillBatch(queuedBatch* entry, nsecs_t queued, const struct input_event* events, int count,
+    char* text, int textLength)
+{
+    entry->queued = queued;
+    entry->text = text;
+    entry->textLength = textLength;
+    entry->count = count;
+    memcpy(entry->events, events, count * sizeof(struct input_event));
+}
+
+static bool push(nsecs_t queued, const struct input_event* events, int count, char* text, int textLength)
+{
+    uint32_t current = head.load(std::memory_order_relaxed);
+    if (current - tail.load() >= QUEUE_SIZE) { return false; }
+
+    fillBatch(&queue[current % QUEUE_SIZE], queued, events, count, text, textLength);
+
+    // sequentially consistent, so either the consumer sees the batch or we see it sleeping
+    head.store(current + 1);
+
+    if (sleeping.exchange(false))
+    {
+        uint64_t wakeup = 1;
+        write(wakeupFd, &wakeup, sizeof(wakeup));
+    }
+
+    return true;
+}
+
+static void pushOverflow(void)
+{
+    while (overflowCount > 0)
+    {
+        queuedBatch* batch = &overflow[overflowStart];
+        if (!push(batch->queued, batch->events, batch->count, batch->text, batch->textLength)) { break; }
+
+        overflowStart++;
+        overflowCount--;
+    }
+
+    if (overflowCount == 0)
+    {
+        overflowStart = 0;
+        overflowing = false;
+    }
+}
+
+static bool holdBack(void)
+{
+    if (overflowStart + overflowCount < overflowCapacity) { return true; }
+
+    // room left at the front is reused before growing
+    if (overflowStart > 0)
+    {
+        memmove(overflow, &overflow[overflowStart], overflowCount * sizeof(queuedBatch));
+        overflowStart = 0;
+        return true;
+    }
+
+    int capacity = (overflowCapacity > 0) ? overflowCapacity * 2 : OVERFLOW_SIZE;
+    queuedBatch* batches = (queuedBatch*) realloc(overflow, capacity * sizeof(queuedBatch));
+    if (batches == NULL) { return false; }
+
+    overflow = batches;
+    overflowCapacity = capacity;
+    return true;
+}
+
+// the RFB thread never waits for the device; while the queue is full, batches are
+// held back in order and only pointer motion may be superseded by newer motion
+static void enqueue(struct suinput_batch* batch, char* text, int textLength)
+{
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (overflowCount > 0) { pushOverflow(); }
+    if (overflowCount == 0 && push(now, batch->events, batch->count, text, textLength))
+    {
+        batch->count = 0;
+        return;
+    }
+
+    queuedBatch* last = (overflowCount > 0) ? &overflow[overflowStart + overflowCount - 1] : NULL;
+    bool motion = (text == NULL && isMotion(batch->events, batch->count));
+    if (last == NULL || !motion || last->text != NULL || !isMotion(last->events, last->count))
+    {
+        if (!holdBack())
+        {
+            LE("Failed holding back %d input events\n", batch->count);
+            free(text);
+            batch->count = 0;
+            return;
+        }
+
+        if (overflowCount == 0) { LW("Input queue full, holding back events\n"); }
+        last = &overflow[overflowStart + overflowCount++];
+    }
+
+    fillBatch(last, now, batch->events, batch->count, text, textLength);
+    batch->count = 0;
+
+    // the consumer wakes up the event loop once it made room, see flushInput();
+    // checked again in case it did so before it saw the flag
+    overflowing = true;
+    pushOverflow();
+}
+
+void setRefreshPeriod(nsecs_t period)
+{
+    L("Coalescing pointer motion every %.1f ms\n", period / 1e6);
+    refreshPeriod = period;
+}
+
+nsecs_t getLastInjection(void)
+{
+    return lastWrite;
+}
+
+void queueInput(struct suinput_batch* batch)
+{
+    if (batch->count == 0) { return; }
+
+    // the batch is emptied either way, it may be full
+    if (!running)
+    {
+        batch->count = 0;
+        return;
+    }
+
+    enqueue(batch, NULL, 0);
+}
+
+void queueText(char* text, int len, struct suinput_batch* batch)
+{
+    if (!running)
+    {
+        free(text);
+        return;
+    }
+
+    enqueue(batch, text, len);
+}
+
+// called by the event loop, which the consumer wakes up once the queue has room again
+void flushInput(void)
+{
+    if (overflowCount > 0) { pushOverflow(); }
+}
+
+void closeInjector(void)
+{
+    // the thread might be blocked in the device, let it run out on its own
+    running = false;
+
+    uint64_t wakeup = 1;
+    if (wakeupFd >= 0) { write(wakeupFd, &wakeup, sizeof(wakeup)); }
+}
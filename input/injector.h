@@ -0,0 +1,41 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef INJECTOR_H
+#define INJECTOR_H
+
+#include <utils/Timers.h>
+
+#include "suinput.h"
+
+// writes queued event batches to uinput on a separate thread,
+// the queue has a single producer (the RFB thread) and a single consumer,
+// pointer motion is coalesced to one report per refresh period,
+// a full queue never blocks the producer, batches are held back until flushInput()
+int initInjector(int uinput_fd);
+void setRefreshPeriod(nsecs_t period);
+nsecs_t getLastInjection(void);
+void queueInput(struct suinput_batch* batch);
+
+// takes ownership of the malloc'ed text, the batch usually holds the paste shortcut
+void queueText(char* text, int len, struct suinput_batch* batch);
+void flushInput(void);
+void closeInjector(void);
+
+#endif
@@ -21,31 +21,57 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "common.h"
 #include "flinger.h"
 #include "suinput.h"
+#include "injector.h"
+#include "touch.h"
+#include "keymap.h"
+#include "clipboard.h"
+#include "client.h"
 #include "input.h"
+#include "latency.h"
 
 extern screenFormat screenformat;
 
 int inputfd = -1;
-// keyboard code modified from remote input by http://www.math.bme.hu/~morap/RemoteInput/
-
-// q,w,e,r,t,y,u,i,o,p,a,s,d,f,g,h,j,k,l,z,x,c,v,b,n,m
-int qwerty[] = {30,48,46,32,18,33,34,35,23,36,37,38,50,49,24,25,16,19,31,20,22,47,17,45,21,44};
-// ,!,",#,$,%,&,',(,),*,+,,,-,.,/
-int spec1[] = {57,2,40,4,5,6,8,40,10,11,9,13,51,12,52,52};
-int spec1sh[] = {0,1,1,1,1,1,1,0,1,1,1,1,0,0,0,1};
-// :,;,<,=,>,?,@
-int spec2[] = {39,39,227,13,228,53,3};
-int spec2sh[] = {1,0,1,1,1,1,1};
-// [,\,],^,_,`
-int spec3[] = {26,43,27,7,12,399};
-int spec3sh[] = {0,0,0,1,1,0};
-// {,|,},~
-int spec4[] = {26,43,27,215,14};
-int spec4sh[] = {1,1,1,1,0};
+
+// events of one callback are queued and written with a single system call
+static struct suinput_batch batch;
+
+// key events waiting on the socket before typing is treated as a paste (bytes)
+#define PASTE_PENDING (8 * sz_rfbKeyEventMsg)
+
+// initial size of the text collected during a paste
+#define PASTE_BUFFER 4096
+
+// how many clients hold each key, the device only sees the first press and last release
+static uint8_t deviceKeys[KEY_CNT];
+
+enum gestureMode { GESTURE_NONE, GESTURE_PINCH, GESTURE_PAN };
+
+// distance of the second finger during a two finger drag
+#define PAN_DISTANCE 200
+
+// the touch axes have a fixed range, so the device can be created before the
+// display size is known; Android scales the range to the display on its own
+#define TOUCH_RANGE 32767
+
+// events written shortly before the device is destroyed need time to be read (ms)
+#define INPUT_DRAIN 100
+
+static inline int deviceX(int x)
+{
+	x = (x < 0) ? 0 : ((x > screenformat.width) ? screenformat.width : x);
+	return x * TOUCH_RANGE / screenformat.width;
+}
+
+static inline int deviceY(int y)
+{
+	y = (y < 0) ? 0 : ((y > screenformat.height) ? screenformat.height : y);
+	return y * TOUCH_RANGE / screenformat.height;
+}
 
 void initInput()
 {
-	L("Initializing keyboard and touch for w=%d and h=%d...\n", screenformat.width, screenformat.height);
+	L("Initializing keyboard and touch...\n");
 	struct input_id id =
 	{
 		BUS_VIRTUAL, /* Bus type: 0x06*/
@@ -54,336 +80,362 @@ void initInput()
 		1  /* Version id. */
 	};
 
-	if ((inputfd = suinput_open("VNC", &id, screenformat.width, screenformat.height)) == -1)
+	if ((inputfd = suinput_open("VNC", &id, TOUCH_RANGE, TOUCH_RANGE)) == -1)
+	{
+		LE("Cannot create virtual input devices\n");
+		return;
+	}
+
+	// long transitions, e.g. releasing everything a client held, span several
+	// batches, which are queued in order instead of being written right away
+	suinput_batch_init(&batch, inputfd);
+	batch.full = queueInput;
+	if (initInjector(inputfd) != 0)
+	{
+		LE("Cannot start input injection\n");
+		suinput_close(inputfd);
+		inputfd = -1;
+	}
+}
+
+static void setKey(uint16_t code, bool down)
+{
+	if (down)
+	{
+		if (deviceKeys[code]++ == 0) suinput_batch_add(&batch, EV_KEY, code, 1);
+	}
+	else if (deviceKeys[code] > 0)
+	{
+		if (--deviceKeys[code] == 0) suinput_batch_add(&batch, EV_KEY, code, 0);
+	}
+}
+
+static void setModifiers(int modifiers, bool down)
+{
+	if (modifiers & KEYMAP_CTRL) setKey(KEY_LEFTCTRL, down);
+	if (modifiers & KEYMAP_ALT) setKey(KEY_LEFTALT, down);
+	if (modifiers & KEYMAP_ALTGR) setKey(KEY_RIGHTALT, down);
+	if (modifiers & KEYMAP_SHIFT) setKey(KEY_LEFTSHIFT, down);
+}
+
+// text is committed by pasting it through the clipboard, takes ownership of the text
+static void commitText(char* text, int len)
+{
+	setKey(KEY_LEFTCTRL, true);
+	setKey(KEY_V, true);
+	suinput_batch_syn(&batch);
+	setKey(KEY_V, false);
+	setKey(KEY_LEFTCTRL, false);
+	suinput_batch_syn(&batch);
+
+	queueText(text, len, &batch);
+}
+
+// characters without a key in the layout
+static void commitCharacter(uint32_t unicode)
+{
+	char* text = (char*) malloc(4);
+	int len = (text != NULL) ? unicodeToUtf8(unicode, text) : 0;
+	if (len == 0)
+	{
+		free(text);
+		return;
+	}
+
+	commitText(text, len);
+}
+
+// bytes of further messages the viewer already sent
+static int pendingInput(rfbClientPtr cl)
+{
+	int pending = 0;
+	if (ioctl(cl->sock, FIONREAD, &pending) != 0) return 0;
+	return pending;
+}
+
+// characters which end up in the text when they are part of a paste
+static uint32_t pasteCharacter(clientState* state, rfbKeySym key)
+{
+	if (state->heldModifiers & ~KEYMAP_SHIFT) return 0;
+	if (key == 0xff0d) return '\n'; // Return
+	if (key == 0xff09) return '\t'; // Tab
+	return keysymToUnicode(key);
+}
+
+static bool appendPaste(clientState* state, uint32_t unicode)
+{
+	if (state->pasteLength + 4 > state->pasteCapacity)
+	{
+		int capacity = (state->pasteCapacity > 0) ? state->pasteCapacity * 2 : PASTE_BUFFER;
+		char* text = (char*) realloc(state->pasteText, capacity);
+		if (text == NULL) return false;
+
+		state->pasteText = text;
+		state->pasteCapacity = capacity;
+	}
+
+	state->pasteLength += unicodeToUtf8(unicode, state->pasteText + state->pasteLength);
+	return true;
+}
+
+static void flushPaste(rfbClientPtr cl, clientState* state)
+{
+	if (state->pasteLength == 0)
+		return;
+
+	LD("Pasting %d bytes typed by %s\n", state->pasteLength, cl->host);
+	commitText(state->pasteText, state->pasteLength);
+
+	state->pasteText = NULL;
+	state->pasteLength = 0;
+	state->pasteCapacity = 0;
+}
+
+static pressedKey* findPressedKey(clientState* state, uint32_t keysym)
+{
+	for (int i = 0; i < state->pressedCount; i++)
+	{
+		if (state->pressedKeys[i].keysym == keysym) return &state->pressedKeys[i];
+	}
+
+	return NULL;
+}
+
+// viewers paste by typing the text as fast as they can; once enough key events are
+// already waiting on the socket the characters are collected and pasted at once
+static bool handlePaste(rfbBool down, rfbKeySym key, rfbClientPtr cl, clientState* state)
+{
+	uint32_t unicode = pasteCharacter(state, key);
+	bool pasting = state->pasteLength > 0;
+
+	// viewers hold shift around capitals, which does not end a paste,
+	// but its release may be the last event of one
+	if (modifierFlag(key) == KEYMAP_SHIFT)
+	{
+		if (pasting && pendingInput(cl) == 0) flushPaste(cl, state);
+		return false;
+	}
+
+	if (unicode == 0 || findPressedKey(state, key) != NULL)
+	{
+		flushPaste(cl, state);
+		return false;
+	}
+
+	// the releases of collected characters have nothing left to do,
+	// unless the last one completes the paste
+	if (!down)
+	{
+		if (pasting && pendingInput(cl) == 0) flushPaste(cl, state);
+		return pasting;
+	}
+
+	if (!pasting && pendingInput(cl) < PASTE_PENDING)
+		return false;
+
+	if (!appendPaste(state, unicode))
 	{
-		L("Cannot create virtual input devices\n");
+		flushPaste(cl, state);
+		return false;
 	}
+
+	if (pendingInput(cl) == 0) flushPaste(cl, state);
+	return true;
+}
+
+// the modifier which started a gesture
+static int gestureModifier(int gesture)
+{
+	if (gesture == GESTURE_PINCH) return KEYMAP_ALT;
+	if (gesture == GESTURE_PAN) return KEYMAP_SHIFT;
+	return 0;
 }
 
-int keysym2scancode(rfbBool down, rfbKeySym c, int *sh, int *alt)
+// apps must not see the modifier along with the fingers, it is pressed again afterwards
+static void withholdModifier(clientState* state, int modifier, bool withhold)
 {
-	int real = 1;
-
-	if ('a' <= c && c <= 'z')
-	{
-		return qwerty[c - 'a'];
-	}
-	if ('A' <= c && c <= 'Z')
-	{
-		(*sh) = 1;
-		return qwerty[c - 'A'];
-	}
-
-	if (c == '0')
-		return 11;
-	if ('1' <= c && c <= '9')
-		return c-'1'+2;
-
-	if (32 <= c && c <= 47)
-	{
-		(*sh) = spec1sh[c-32];
-		return spec1[c-32];
-	}
-	if (58 <= c && c <= 64)
-	{
-		(*sh) = spec2sh[c-58];
-		return spec2[c-58];
-	}
-	if (91 <= c && c <= 96)
-	{
-		(*sh) = spec3sh[c-91];
-		return spec3[c-91];
-	}
-	if (123 <= c && c <= 127)
-	{
-		(*sh) = spec4sh[c-123]; 
-		return spec4[c-123];
-	}
-
-	switch(c)
-	{
-		case 0xff08:
-			return 14;// backspace
-		case 0xff09: 
-			return 15;// tab
-		case 1: 
-			(*alt)=1;
-			return 34;// ctrl+a
-		case 3: 
-			(*alt)=1; 
-			return 46;// ctrl+c
-		case 4: 
-			(*alt)=1; 
-			return 32;// ctrl+d
-		case 18:
-			(*alt)=1; 
-			return 31;// ctrl+r
-		case 0xff0D: 
-			return 28;// enter
-		case 0xff1B: 
-			return 158;// esc -> back
-		case 0xFF51: 
-			return 105;// left -> DPAD_LEFT
-		case 0xFF53: 
-			return 106;// right -> DPAD_RIGHT
-		case 0xFF54: 
-			return 108;// down -> DPAD_DOWN
-		case 0xFF52:
-			return 103;// up -> DPAD_UP
-		//case 360:
-		//	return 232;// end -> DPAD_CENTER (ball click)
-		case 0xff50:
-			return KEY_HOME;// home 
-		case 0xFFC8:
-			return 0; //F11 ?
-		case 0xFFC9:
-			return 0; // F10 or F12?
-		case 0xffc1:
-		//	down ? rotate(-1) : 0;
-			return 0; // F4 rotate
-		case 0xffff: 
-			return 158;// del -> back
-		case 0xff55: 
-			return 229;// PgUp -> menu
-		case 0xffcf: 
-			return 127;// F2 -> search
-		case 0xffe3: 
-			return 127;// left ctrl -> search
-		case 0xff56: 
-			return 61;// PgUp -> call
-		case 0xff57: 
-			return 107;// End -> endcall
-		case 0xffc2: 
-			return 211;// F5 -> focus
-		case 0xffc3: 
-			return 212;// F6 -> camera
-		case 0xffc4: 
-			return 150;// F7 -> explorer
-		case 0xffc5: 
-			return 155;// F8 -> envelope
-
-		case 50081:
-		case 225:
-			(*alt)=1;
-			if (real)
-				return 48; //a with acute
-			return 30; //a with acute -> a with ring above
-			
-		case 50049:
-		case 193:
-			(*sh)=1;
-			(*alt)=1;
-			if (real)
-				return 48; //A with acute 
-			return 30; //A with acute -> a with ring above
-			
-		case 50089:
-		case 233: 
-			(*alt)=1;
-			return 18; //e with acute
-			
-		case 50057:
-		case 201:
-			(*sh)=1;
-			(*alt)=1;
-			return 18; //E with acute
-			
-		case 50093:
-		case 0xffbf:
-			(*alt)=1; 
-			if (real)
-				return 36; //i with acute 
-			return 23; //i with acute -> i with grave
-			
-		case 50061:
-		case 205: 
-			(*sh)=1;
-			(*alt)=1; 
-			if (real)
-				return 36; //I with acute 
-			return 23; //I with acute -> i with grave
-			
-		case 50099: 
-		case 243:
-			(*alt)=1; 
-			if (real) 
-				return 16; //o with acute 
-			return 24; //o with acute -> o with grave
-			
-		case 50067: 
-		case 211:
-			(*sh)=1;
-			(*alt)=1; 
-			if (real) 
-				return 16; //O with acute 
-			return 24; //O with acute -> o with grave
-			
-		case 50102:
-		case 246: 
-			(*alt)=1;
-			return 25; //o with diaeresis
-			
-		case 50070:
-		case 214:
-			(*sh)=1;
-			(*alt)=1;
-			return 25; //O with diaeresis
-		
-		case 50577: 
-		case 245:
-			(*alt)=1; 
-			if (real)
-				return 19; //Hungarian o 
-			return 25; //Hungarian o -> o with diaeresis
-
-		case 50576:
-		case 213: 
-			(*sh)=1;
-			(*alt)=1;
-			if (real)
-				return 19; //Hungarian O
-			return 25; //Hungarian O -> O with diaeresis
-
-		case 50106:
-		//case 0xffbe:
-		//	(*alt)=1;
-		// 	if (real)
-		//		return 17; //u with acute
-		// 	return 22; //u with acute -> u with grave
-		case 50074:
-		case 218: 
-			(*sh)=1;
-			(*alt)=1; 
-			if (real) 
-				return 17; //U with acute 
-			return 22; //U with acute -> u with grave
-		case 50108:
-		case 252: 
-			(*alt)=1;
-			return 47; //u with diaeresis
-			
-		case 50076:
-		case 220:
-			(*sh)=1;
-			(*alt)=1;
-			return 47; //U with diaeresis
-			
-		case 50609:
-		case 251: 
-			(*alt)=1; 
-			if (real) 
-				return 45; //Hungarian u 
-			return 47; //Hungarian u -> u with diaeresis
-			
-		case 50608:
-		case 219: 
-			(*sh)=1;
-			(*alt)=1;
-			if (real)
-				return 45; //Hungarian U 
-			return 47; //Hungarian U -> U with diaeresis
-
-		default:
-			return 0;
+	bool changed = false;
+	for (int i = 0; i < state->pressedCount; i++)
+	{
+		pressedKey* key = &state->pressedKeys[i];
+		if (modifierFlag(key->keysym) != modifier || key->withheld == withhold) continue;
+
+		setKey(key->code, !withhold);
+		key->withheld = withhold;
+		changed = true;
 	}
+
+	if (changed) suinput_batch_syn(&batch);
+}
+
+static void releaseKey(clientState* state, pressedKey* key)
+{
+	// a single report for the whole transition
+	if (!key->withheld) setKey(key->code, false);
+	setModifiers(key->synthetic, false);
+	suinput_batch_syn(&batch);
+
+	*key = state->pressedKeys[--state->pressedCount];
 }
 
 void keyEvent(rfbBool down, rfbKeySym key, rfbClientPtr cl)
 {
 	//L("Got key: %04x (down=%d)\n", (unsigned int)key, (int)down);
-	setIdle(0);
+	startCaptureBurst();
+	markInput(cl, -1, -1);
 
-	int shift = 0;
-	int alt = 0;
-	int code = 0;
+	clientState* state = getClientState(cl);
+	if (inputfd == -1 || state == NULL)
+		return;
 
-	if (inputfd == -1)
+	if (handlePaste(down, key, cl, state))
 		return;
 
-	if ((code = keysym2scancode(down, key, &shift, &alt)))
+	int modifier = modifierFlag(key);
+	if (modifier != 0)
 	{
-		if (key && down)
+		if (down) state->heldModifiers |= modifier;
+		else state->heldModifiers &= ~modifier;
+	}
+
+	// the viewer might release a different keysym than it pressed, e.g. 'a' after 'A'
+	// once shift is gone, so keys are released by the scancode they were pressed with
+	pressedKey* pressed = findPressedKey(state, key);
+	if (!down)
+	{
+		keyMapping mapping;
+		if (pressed == NULL && lookupKeysym(key, &mapping))
 		{
-			if (shift) suinput_press(inputfd, 42); //left shift
-			if (alt) suinput_press(inputfd, 56); //left alt
-			suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
+			for (int i = 0; i < state->pressedCount && pressed == NULL; i++)
+			{
+				if (state->pressedKeys[i].code == mapping.code) pressed = &state->pressedKeys[i];
+			}
+		}
 
-			suinput_press(inputfd, code);
-			suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
+		if (pressed != NULL)
+		{
+			releaseKey(state, pressed);
+			queueInput(&batch);
+		}
+		return;
+	}
 
-			suinput_release(inputfd, code);
-			suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
+	// repeated presses are dropped, Android generates key repeats itself
+	if (pressed != NULL)
+		return;
 
-			if (alt) suinput_release(inputfd, 56); //left alt
-			if (shift) suinput_release(inputfd, 42); //left shift
-			suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
-		}
+	keyMapping mapping;
+	if (!lookupKeysym(key, &mapping))
+	{
+		uint32_t unicode = keysymToUnicode(key);
+		if (unicode != 0) commitCharacter(unicode);
+		return;
 	}
+
+	if (state->pressedCount == MAX_PRESSED_KEYS)
+	{
+		LW("Client %s holds too many keys\n", cl->host);
+		return;
+	}
+
+	// modifiers the character needs but the client does not hold are pressed along with it
+	pressed = &state->pressedKeys[state->pressedCount++];
+	pressed->keysym = key;
+	pressed->code = mapping.code;
+	pressed->synthetic = mapping.modifiers & ~state->heldModifiers;
+	pressed->withheld = (modifier != 0 && modifier == gestureModifier(state->gesture));
+	if (pressed->withheld)
+	{
+		pressed->synthetic = 0;
+		return;
+	}
+
+	setModifiers(pressed->synthetic, true);
+	setKey(pressed->code, true);
+	suinput_batch_syn(&batch);
+	queueInput(&batch);
 }
 
 void ptrEvent(int buttonMask, int x, int y, rfbClientPtr cl)
 {
-	static int leftClicked = 0;
 	static int middleClicked = 0;
 	static int rightClicked = 0;
 	static int scrollUp = 0;
 	static int scrollDown = 0;
 
-	if (inputfd == -1)
+	clientState* state = getClientState(cl);
+	if (inputfd == -1 || state == NULL)
 		return;
 
 //	L("Process event (%d, %d) with mask %u\n", x, y, buttonMask);
+	// hovering without buttons has no visible effect on a touch screen
+	if (buttonMask != 0 || state->leftDown || middleClicked || rightClicked || scrollUp || scrollDown)
+		markInput(cl, x, y);
+
 	rotateCoordinates(&x, &y);
 //	scaleCoordinates(&x, &y);
-	setIdle(0);
+	startCaptureBurst();
 
-	if ((buttonMask & 1) && leftClicked) // left btn pressed and moving
-	{
-		suinput_write(inputfd, EV_ABS, ABS_X, x);
-		suinput_write(inputfd, EV_ABS, ABS_Y, y);
-		suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
-	}
-	else if (buttonMask & 1) // left btn pressed
+	if (buttonMask & 1) // left btn pressed
 	{
-		leftClicked = 1;
-		suinput_write(inputfd, EV_ABS, ABS_X, x);
-		suinput_write(inputfd, EV_ABS, ABS_Y, y);
-		suinput_write(inputfd, EV_KEY, BTN_TOUCH, 1);
-		suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
+		if (!state->leftDown)
+		{
+			// Alt pinches around the point where the drag started, Shift drags with two fingers
+			state->leftDown = true;
+			int modifiers = state->heldModifiers;
+			state->gesture = (modifiers & KEYMAP_ALT) ? GESTURE_PINCH : ((modifiers & KEYMAP_SHIFT) ? GESTURE_PAN : GESTURE_NONE);
+			state->gestureX = x;
+			state->gestureY = y;
+			if (state->gesture != GESTURE_NONE) withholdModifier(state, gestureModifier(state->gesture), true);
+		}
+
+		setContact(cl, POINTER_CONTACT, true, deviceX(x), deviceY(y));
+		if (state->gesture == GESTURE_PINCH)
+		{
+			setContact(cl, GESTURE_CONTACT, true, deviceX(2 * state->gestureX - x), deviceY(2 * state->gestureY - y));
+		}
+		else if (state->gesture == GESTURE_PAN)
+		{
+			int offset = (x + PAN_DISTANCE < screenformat.width) ? PAN_DISTANCE : -PAN_DISTANCE;
+			setContact(cl, GESTURE_CONTACT, true, deviceX(x + offset), deviceY(y));
+		}
+		commitContacts(&batch);
 	}
-	else if (leftClicked) // left btn released
+	else if (state->leftDown) // left btn released
 	{
-		leftClicked=0;
-		suinput_write(inputfd, EV_ABS, ABS_X, x);
-		suinput_write(inputfd, EV_ABS, ABS_Y, y);
-		suinput_write(inputfd, EV_KEY, BTN_TOUCH, 0);
-		suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
+		state->leftDown = false;
+		setContact(cl, POINTER_CONTACT, false, x, y);
+		setContact(cl, GESTURE_CONTACT, false, x, y);
+		commitContacts(&batch);
+
+		if (state->gesture != GESTURE_NONE) withholdModifier(state, gestureModifier(state->gesture), false);
+		state->gesture = GESTURE_NONE;
 	}
 
 	if (buttonMask & 2) // mid btn pressed
 	{
 		middleClicked=1;
-		suinput_press(inputfd, KEY_END);
-		suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
+		suinput_batch_add(&batch, EV_KEY, KEY_END, 1);
+		suinput_batch_syn(&batch);
 	}
 	else if (middleClicked) // mid btn released
 	{
 		middleClicked=0;
-		suinput_release(inputfd, KEY_END);
-		suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
+		suinput_batch_add(&batch, EV_KEY, KEY_END, 0);
+		suinput_batch_syn(&batch);
 	}
 
 	if (buttonMask & 4) // right btn pressed
 	{
 		rightClicked=1;
-		suinput_press(inputfd, 158); // back key
-		suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
+		suinput_batch_add(&batch, EV_KEY, 158, 1); // back key
+		suinput_batch_syn(&batch);
 	}
 	else if (rightClicked) // right button released
 	{
 		rightClicked=0;
-		suinput_release(inputfd, 158);
-		suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
+		suinput_batch_add(&batch, EV_KEY, 158, 0);
+		suinput_batch_syn(&batch);
 	}
 
 	if (buttonMask & 8) // scroll up started
@@ -393,14 +445,14 @@ void ptrEvent(int buttonMask, int x, int y, rfbClientPtr cl)
 	else if (scrollUp) // scroll up finished
 	{
 		scrollUp=0;
-		suinput_write(inputfd, EV_REL, REL_X, -(cl->screen->width * 2));
-		suinput_write(inputfd, EV_REL, REL_Y, -(cl->screen->height * 2));
-		suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
-		suinput_write(inputfd, EV_REL, REL_X, x);
-		suinput_write(inputfd, EV_REL, REL_Y, y);
-		suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
-		suinput_write(inputfd, EV_REL, REL_WHEEL, 1);
-		suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
+		suinput_batch_add(&batch, EV_REL, REL_X, -(cl->screen->width * 2));
+		suinput_batch_add(&batch, EV_REL, REL_Y, -(cl->screen->height * 2));
+		suinput_batch_syn(&batch);
+		suinput_batch_add(&batch, EV_REL, REL_X, x);
+		suinput_batch_add(&batch, EV_REL, REL_Y, y);
+		suinput_batch_syn(&batch);
+		suinput_batch_add(&batch, EV_REL, REL_WHEEL, 1);
+		suinput_batch_syn(&batch);
 	}
 
 	if (buttonMask & 16) // scroll down started
@@ -410,15 +462,67 @@ void ptrEvent(int buttonMask, int x, int y, rfbClientPtr cl)
 	else if (scrollDown) // scroll down finished
 	{
 		scrollDown=0;
-		suinput_write(inputfd, EV_REL, REL_X, -(cl->screen->width * 2));
-		suinput_write(inputfd, EV_REL, REL_Y, -(cl->screen->height * 2));
-		suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
-		suinput_write(inputfd, EV_REL, REL_X, x);
-		suinput_write(inputfd, EV_REL, REL_Y, y);
-		suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
-		suinput_write(inputfd, EV_REL, REL_WHEEL, -1);
-		suinput_write(inputfd, EV_SYN, SYN_REPORT, 0);
+		suinput_batch_add(&batch, EV_REL, REL_X, -(cl->screen->width * 2));
+		suinput_batch_add(&batch, EV_REL, REL_Y, -(cl->screen->height * 2));
+		suinput_batch_syn(&batch);
+		suinput_batch_add(&batch, EV_REL, REL_X, x);
+		suinput_batch_add(&batch, EV_REL, REL_Y, y);
+		suinput_batch_syn(&batch);
+		suinput_batch_add(&batch, EV_REL, REL_WHEEL, -1);
+		suinput_batch_syn(&batch);
+	}
+
+	queueInput(&batch);
+}
+
+void touchEvent(int count, const touchPoint* points, rfbClientPtr cl)
+{
+	if (inputfd == -1)
+		return;
+
+	startCaptureBurst();
+	if (count > 0)
+		markInput(cl, points[0].x, points[0].y);
+
+	for (int i = 0; i < count; i++)
+	{
+		int x = points[i].x;
+		int y = points[i].y;
+		rotateCoordinates(&x, &y);
+		setContact(cl, points[i].id, points[i].down, deviceX(x), deviceY(y));
 	}
+
+	commitContacts(&batch);
+	queueInput(&batch);
+}
+
+// a paste may also end with other messages than key events, called once they were processed
+void finishPaste(rfbClientPtr cl)
+{
+	clientState* state = getClientState(cl);
+	if (inputfd == -1 || state == NULL || state->pasteLength == 0)
+		return;
+
+	if (pendingInput(cl) == 0) flushPaste(cl, state);
+}
+
+void releaseInput(rfbClientPtr cl)
+{
+	if (inputfd == -1)
+		return;
+
+	// fingers and keys of a vanished client must not stay pressed
+	releaseContacts(cl);
+	commitContacts(&batch);
+
+	clientState* state = getClientState(cl);
+	if (state != NULL) flushPaste(cl, state);
+	while (state != NULL && state->pressedCount > 0)
+	{
+		releaseKey(state, &state->pressedKeys[state->pressedCount - 1]);
+	}
+
+	queueInput(&batch);
 }
 
 inline void rotateCoordinates(int* x, int* y)
@@ -471,6 +575,14 @@ void cleanupInput()
 {
 	if (inputfd != -1)
 	{
+		closeInjector();
+
+		nsecs_t idle = systemTime(SYSTEM_TIME_MONOTONIC) - getLastInjection();
+		if (idle < ms2ns(INPUT_DRAIN))
+		{
+			usleep(ns2us(ms2ns(INPUT_DRAIN) - idle));
+		}
+
 		suinput_close(inputfd);
 	}
 }
@@ -21,15 +21,18 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define KEYMANIP_H
 
 #include "rfb/rfb.h"
+#include "touch.h"
 
 #define BUS_VIRTUAL 0x06
 
 void initInput();
-int keysym2scancode(rfbBool down, rfbKeySym c, int *sh, int *alt);
 void rotateCoordinates(int* x, int* y);
 void scaleCoordinates(int* x, int* y);
 void ptrEvent(int buttonMask, int x, int y, rfbClientPtr cl);
 void keyEvent(rfbBool down, rfbKeySym key, rfbClientPtr cl);
+void touchEvent(int count, const touchPoint* points, rfbClientPtr cl);
+void finishPaste(rfbClientPtr cl);
+void releaseInput(rfbClientPtr cl);
 void cleanupInput();
 
 #endif
@@ -0,0 +1,389 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <array>
+
+#include "common.h"
+#include "keysyms.h"
+#include "keymap.h"
+
+// characters typed with a single key, indexed by their Latin-1 code point
+typedef std::array<keyMapping, 256> denseLayout;
+
+// a row of neighbouring scancodes, a space marks a position without a character
+struct layoutRow
+{
+    uint16_t start;
+    uint8_t modifiers;
+    const char16_t* keys;
+};
+
+// characters outside of Latin-1
+struct layoutExtra
+{
+    uint32_t unicode;
+    keyMapping mapping;
+};
+
+struct keyboardLayout
+{
+    const char* name;
+    const denseLayout* dense;
+    const layoutExtra* extra;
+    size_t extraCount;
+};
+
+template <size_t N>
+static constexpr denseLayout buildLayout(const layoutRow (&rows)[N])
+{
+    denseLayout layout {};
+    for (size_t r = 0; r < N; r++)
+    {
+        for (size_t i = 0; rows[r].keys[i] != 0; i++)
+        {
+            char16_t c = rows[r].keys[i];
+            if (c == u' ' || c >= layout.size() || layout[c].code != 0) { continue; }
+
+            layout[c] = { (uint16_t) (rows[r].start + i), rows[r].modifiers };
+        }
+    }
+
+    return layout;
+}
+
+template <size_t N>
+static constexpr std::array<keyMapping, 256> buildFunctionKeys(const std::pair<uint16_t, uint16_t> (&keys)[N])
+{
+    std::array<keyMapping, 256> table {};
+    for (size_t i = 0; i < N; i++)
+    {
+        table[keys[i].first & 0xFF] = { keys[i].second, 0 };
+    }
+
+    return table;
+}
+
+static constexpr bool isSorted(const keysymUnicode* table, size_t count)
+{
+    for (size_t i = 1; i < count; i++)
+    {
+        if (table[i - 1].keysym >= table[i].keysym) { return false; }
+    }
+
+    return true;
+}
+
+static_assert(isSorted(keysymTable, sizeof(keysymTable) / sizeof(keysymUnicode)), "keysym table has to be sorted");
+
+// scancodes of the generic Android key layout
+static constexpr layoutRow usRows[] = {
+    { KEY_1,         0,            u"1234567890-=" },
+    { KEY_Q,         0,            u"qwertyuiop[]" },
+    { KEY_A,         0,            u"asdfghjkl;'`" },
+    { KEY_BACKSLASH, 0,            u"\\zxcvbnm,./" },
+    { KEY_1,         KEYMAP_SHIFT, u"!@#$%^&*()_+" },
+    { KEY_Q,         KEYMAP_SHIFT, u"QWERTYUIOP{}" },
+    { KEY_A,         KEYMAP_SHIFT, u"ASDFGHJKL:\"~" },
+    { KEY_BACKSLASH, KEYMAP_SHIFT, u"|ZXCVBNM<>?" },
+};
+
+// dead keys are left out, their characters are committed as text instead
+static constexpr layoutRow deRows[] = {
+    { KEY_1,         0,            u"1234567890ß " },
+    { KEY_Q,         0,            u"qwertzuiopü+" },
+    { KEY_A,         0,            u"asdfghjklöä " },
+    { KEY_BACKSLASH, 0,            u"#yxcvbnm,.-" },
+    { KEY_102ND,     0,            u"<" },
+    { KEY_1,         KEYMAP_SHIFT, u"!\"§$%&/()=? " },
+    { KEY_Q,         KEYMAP_SHIFT, u"QWERTZUIOPÜ*" },
+    { KEY_A,         KEYMAP_SHIFT, u"ASDFGHJKLÖÄ°" },
+    { KEY_BACKSLASH, KEYMAP_SHIFT, u"'YXCVBNM;:_" },
+    { KEY_102ND,     KEYMAP_SHIFT, u">" },
+    { KEY_1,         KEYMAP_ALTGR, u" ²³   {[]}\\ " },
+    { KEY_Q,         KEYMAP_ALTGR, u"@          ~" },
+    { KEY_BACKSLASH, KEYMAP_ALTGR, u"       µ" },
+    { KEY_102ND,     KEYMAP_ALTGR, u"|" },
+};
+
+static constexpr layoutExtra deExtra[] = {
+    { 0x20AC, { KEY_E, KEYMAP_ALTGR } }, // euro sign
+};
+
+static constexpr denseLayout usLayout = buildLayout(usRows);
+static constexpr denseLayout deLayout = buildLayout(deRows);
+
+static const keyboardLayout layouts[] = {
+    { "us", &usLayout, NULL, 0 },
+    { "de", &deLayout, deExtra, sizeof(deExtra) / sizeof(layoutExtra) },
+};
+
+#define LAYOUT_COUNT (sizeof(layouts) / sizeof(keyboardLayout))
+
+static const keyboardLayout* layout = &layouts[0];
+
+// keysyms 0xff00 to 0xffff, including the Android specific assignments;
+// keypad characters are typed through the layout, see keypadCharacter()
+static constexpr std::pair<uint16_t, uint16_t> functionKeyList[] = {
+    { 0xff08, KEY_BACKSPACE },
+    { 0xff09, KEY_TAB },
+    { 0xff0d, KEY_ENTER },
+    { 0xff13, KEY_PAUSE },
+    { 0xff61, KEY_SYSRQ }, // print
+    { 0xff63, KEY_INSERT },
+    { 0xff80, KEY_SPACE }, // keypad space
+    { 0xff89, KEY_TAB },   // keypad tab
+    { 0xff8d, KEY_ENTER }, // keypad enter
+    { 0xff1b, 158 },       // esc -> back
+    { 0xffff, 158 },       // del -> back
+    { 0xff50, KEY_HOME },
+    { 0xff51, KEY_LEFT },  // DPAD_LEFT
+    { 0xff52, KEY_UP },    // DPAD_UP
+    { 0xff53, KEY_RIGHT }, // DPAD_RIGHT
+    { 0xff54, KEY_DOWN },  // DPAD_DOWN
+    { 0xff55, 229 },       // PgUp -> menu
+    { 0xff56, 61 },        // PgDown -> call
+    { 0xff57, 107 },       // End -> endcall
+    { 0xff91, KEY_F1 },    // keypad F1 to F4
+    { 0xff92, KEY_F2 },
+    { 0xff93, KEY_F3 },
+    { 0xff94, KEY_F4 },
+    { 0xff95, KEY_HOME },  // keypad keys without num lock
+    { 0xff96, KEY_LEFT },
+    { 0xff97, KEY_UP },
+    { 0xff98, KEY_RIGHT },
+    { 0xff99, KEY_DOWN },
+    { 0xff9a, KEY_PAGEUP },
+    { 0xff9b, KEY_PAGEDOWN },
+    { 0xff9c, KEY_END },
+    { 0xff9e, KEY_INSERT },
+    { 0xff9f, KEY_DELETE },
+    { 0xffbe, KEY_F1 },
+    { 0xffbf, 127 },       // F2 -> search
+    { 0xffc0, KEY_F3 },
+    { 0xffc1, KEY_F4 },
+    { 0xffe1, KEY_LEFTSHIFT },
+    { 0xffe2, KEY_RIGHTSHIFT },
+    { 0xffe3, KEY_LEFTCTRL },
+    { 0xffe4, KEY_RIGHTCTRL },
+    { 0xffe5, KEY_CAPSLOCK },
+    { 0xffe7, KEY_LEFTMETA },  // left meta
+    { 0xffe8, KEY_RIGHTMETA }, // right meta
+    { 0xffe9, KEY_LEFTALT },
+    { 0xffea, KEY_RIGHTALT },
+    { 0xffeb, KEY_LEFTMETA },  // left super
+    { 0xffec, KEY_RIGHTMETA }, // right super
+    { 0xffc2, 211 },       // F5 -> focus
+    { 0xffc3, 212 },       // F6 -> camera
+    { 0xffc4, 150 },       // F7 -> explorer
+    { 0xffc5, 155 },       // F8 -> envelope
+    { 0xffc6, KEY_F9 },
+    { 0xffc7, KEY_F10 },
+    { 0xffc8, KEY_F11 },
+    { 0xffc9, KEY_F12 },
+};
+
+static constexpr std::array<keyMapping, 256> functionKeys = buildFunctionKeys(functionKeyList);
+
+// keypad keysyms with num lock are their ASCII character moved to 0xff80,
+// Android would need its own num lock state for the keypad scancodes
+static constexpr uint32_t keypadCharacter(uint32_t keysym)
+{
+    if (keysym >= 0xffaa && keysym <= 0xffb9) { return keysym - 0xff80; } // * + , - . / and digits
+    if (keysym == 0xffbd) { return '='; }
+    return 0;
+}
+
+// keysyms of a standard PC keyboard which have to reach the device in some way
+static constexpr uint16_t standardKeysyms[] = {
+    0xff08, 0xff09, 0xff0d, 0xff13, 0xff1b, 0xff50, 0xff51, 0xff52, 0xff53, 0xff54, 0xff55, 0xff56, 0xff57,
+    0xff61, 0xff63, 0xff80, 0xff89, 0xff8d, 0xff91, 0xff92, 0xff93, 0xff94, 0xff95, 0xff96, 0xff97, 0xff98,
+    0xff99, 0xff9a, 0xff9b, 0xff9c, 0xff9e, 0xff9f, 0xffaa, 0xffab, 0xffac, 0xffad, 0xffae, 0xffaf, 0xffb0,
+    0xffb1, 0xffb2, 0xffb3, 0xffb4, 0xffb5, 0xffb6, 0xffb7, 0xffb8, 0xffb9, 0xffbd, 0xffbe, 0xffbf, 0xffc0,
+    0xffc1, 0xffc2, 0xffc3, 0xffc4, 0xffc5, 0xffc6, 0xffc7, 0xffc8, 0xffc9, 0xffe1, 0xffe2, 0xffe3, 0xffe4,
+    0xffe5, 0xffe7, 0xffe8, 0xffe9, 0xffea, 0xffeb, 0xffec, 0xffff,
+};
+
+static constexpr bool coversKeysyms(const std::array<keyMapping, 256>& table, const uint16_t* keysyms, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (table[keysyms[i] & 0xFF].code == 0 && keypadCharacter(keysyms[i]) == 0) { return false; }
+    }
+
+    return true;
+}
+
+static_assert(coversKeysyms(functionKeys, standardKeysyms, sizeof(standardKeysyms) / sizeof(uint16_t)),
+    "function keys have to cover the standard keysyms");
+
+bool setKeyboardLayout(const char* name)
+{
+    for (unsigned int i = 0; i < LAYOUT_COUNT; i++)
+    {
+        if (strcmp(layouts[i].name, name) == 0)
+        {
+            layout = &layouts[i];
+            return true;
+        }
+    }
+
+    LW("Unknown keyboard layout %s, keeping %s\n", name, layout->name);
+    return false;
+}
+
+uint32_t keysymToUnicode(uint32_t keysym)
+{
+    // Latin-1 keysyms are identical to their code points
+    if ((keysym >= 0x20 && keysym <= 0x7e) || (keysym >= 0xa0 && keysym <= 0xff)) { return keysym; }
+
+    // directly encoded Unicode keysyms
+    if ((keysym & 0xff000000) == 0x01000000) { return keysym & 0x00ffffff; }
+
+    // keypad keys with num lock
+    uint32_t keypad = keypadCharacter(keysym);
+    if (keypad != 0) { return keypad; }
+
+    size_t low = 0;
+    size_t high = sizeof(keysymTable) / sizeof(keysymUnicode);
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        if (keysymTable[mid].keysym < keysym) { low = mid + 1; }
+        else { high = mid; }
+    }
+
+    if (low < sizeof(keysymTable) / sizeof(keysymUnicode) && keysymTable[low].keysym == keysym)
+    {
+        return keysymTable[low].unicode;
+    }
+
+    return 0;
+}
+
+static bool lookupUnicode(uint32_t unicode, keyMapping* mapping)
+{
+    if (unicode == ' ')
+    {
+        *mapping = { KEY_SPACE, 0 };
+        return true;
+    }
+
+    if (unicode < layout->dense->size())
+    {
+        *mapping = (*layout->dense)[unicode];
+        return mapping->code != 0;
+    }
+
+    for (size_t i = 0; i < layout->extraCount; i++)
+    {
+        if (layout->extra[i].unicode == unicode)
+        {
+            *mapping = layout->extra[i].mapping;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int modifierFlag(uint32_t keysym)
+{
+    switch (keysym)
+    {
+        case 0xffe1: // Shift_L
+        case 0xffe2: // Shift_R
+            return KEYMAP_SHIFT;
+        case 0xffe3: // Control_L
+        case 0xffe4: // Control_R
+            return KEYMAP_CTRL;
+        case 0xffe9: // Alt_L
+            return KEYMAP_ALT;
+        case 0xffea: // Alt_R
+        case 0xfe03: // ISO_Level3_Shift
+            return KEYMAP_ALTGR;
+        default:
+            return 0;
+    }
+}
+
+bool lookupKeysym(uint32_t keysym, keyMapping* mapping)
+{
+    // AltGr is sent as ISO_Level3_Shift by most viewers
+    if (keysym == 0xfe03)
+    {
+        *mapping = { KEY_RIGHTALT, 0 };
+        return true;
+    }
+
+    if ((keysym & 0xffffff00) == 0xff00)
+    {
+        *mapping = functionKeys[keysym & 0xff];
+        if (mapping->code != 0) { return true; }
+
+        // keypad characters are typed with the key the layout has for them
+        uint32_t keypad = keypadCharacter(keysym);
+        return keypad != 0 && lookupUnicode(keypad, mapping);
+    }
+
+    // some viewers send control characters instead of ctrl + letter
+    if (keysym >= 1 && keysym <= 26)
+    {
+        if (!lookupUnicode('a' + keysym - 1, mapping)) { return false; }
+        mapping->modifiers |= KEYMAP_CTRL;
+        return true;
+    }
+
+    uint32_t unicode = keysymToUnicode(keysym);
+    return unicode != 0 && lookupUnicode(unicode, mapping);
+}
+
+int unicodeToUtf8(uint32_t unicode, char* out)
+{
+    if (unicode < 0x80)
+    {
+        out[0] = unicode;
+        return 1;
+    }
+
+    if (unicode < 0x800)
+    {
+        out[0] = 0xC0 | (unicode >> 6);
+        out[1] = 0x80 | (unicode & 0x3F);
+        return 2;
+    }
+
+    if (unicode < 0x10000)
+    {
+        out[0] = 0xE0 | (unicode >> 12);
+        out[1] = 0x80 | ((unicode >> 6) & 0x3F);
+        out[2] = 0x80 | (unicode & 0x3F);
+        return 3;
+    }
+
+    if (unicode < 0x110000)
+    {
+        out[0] = 0xF0 | (unicode >> 18);
+        out[1] = 0x80 | ((unicode >> 12) & 0x3F);
+        out[2] = 0x80 | ((unicode >> 6) & 0x3F);
+        out[3] = 0x80 | (unicode & 0x3F);
+        return 4;
+    }
+
+    return 0;
+}
@@ -0,0 +1,45 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include <stdint.h>
+
+// modifiers which have to be held to type a character
+#define KEYMAP_SHIFT (1 << 0)
+#define KEYMAP_ALTGR (1 << 1)
+#define KEYMAP_CTRL  (1 << 2)
+#define KEYMAP_ALT   (1 << 3)
+
+typedef struct _keyMapping
+{
+    uint16_t code;
+    uint8_t modifiers;
+} keyMapping;
+
+// the layout has to match the one Android uses for the VNC keyboard
+bool setKeyboardLayout(const char* name);
+
+uint32_t keysymToUnicode(uint32_t keysym);
+bool lookupKeysym(uint32_t keysym, keyMapping* mapping);
+int modifierFlag(uint32_t keysym);
+int unicodeToUtf8(uint32_t unicode, char* out);
+
+#endif
@@ -24,10 +24,21 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <unistd.h>
 #include <linux/uinput.h>
 #include <stdio.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+#include <utils/Timers.h>
 
 #include "common.h"
 #include "suinput.h"
 
+#ifndef UI_GET_SYSNAME
+#define UI_GET_SYSNAME(len) _IOC(_IOC_READ, UINPUT_IOCTL_BASE, 44, len)
+#endif
+
+/* Upper bound for the device node to show up, the old fixed delay. */
+#define SUINPUT_READY_TIMEOUT 2000
+
 const char* UINPUT_FILEPATHS[] = {
     "/dev/uinput",
     "/dev/input/uinput",
@@ -36,10 +47,78 @@ const char* UINPUT_FILEPATHS[] = {
 
 #define UINPUT_FILEPATHS_COUNT (sizeof(UINPUT_FILEPATHS) / sizeof(char*))
 
+/*
+  Looks up the evdev node (eventN) the kernel created for the uinput device.
+*/
+static int suinput_event_name(int uinput_fd, char* name, size_t len)
+{
+    char sysname[64];
+    char path[128];
+
+    if (ioctl(uinput_fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0)
+        return -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/virtual/input/%s", sysname);
+    DIR* dir = opendir(path);
+    if (dir == NULL)
+        return -1;
+
+    int result = -1;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "event", 5) == 0) {
+            strncpy(name, entry->d_name, len - 1);
+            name[len - 1] = '\0';
+            result = 0;
+            break;
+        }
+    }
+
+    closedir(dir);
+    return result;
+}
+
+/*
+  Waits until the device node is accessible in /dev/input, which is when
+  the input reader of Android picks it up. The inotify watch has to exist
+  before the device is created, otherwise the creation might be missed.
+*/
+static void suinput_wait_ready(int uinput_fd, int inotify_fd)
+{
+    char name[32];
+    char path[64];
+
+    if (suinput_event_name(uinput_fd, name, sizeof(name)) != 0) {
+        /* Kernels without UI_GET_SYSNAME, fall back to the fixed delay. */
+        LW("Cannot query uinput device node, waiting for it...\n");
+        sleep(2);
+        return;
+    }
+
+    snprintf(path, sizeof(path), "/dev/input/%s", name);
+    int remaining = SUINPUT_READY_TIMEOUT;
+    while (access(path, R_OK) != 0 && remaining > 0) {
+        struct pollfd pfd = { inotify_fd, POLLIN, 0 };
+        int64_t start = ns2ms(systemTime(SYSTEM_TIME_MONOTONIC));
+        if (inotify_fd < 0 || poll(&pfd, 1, remaining) <= 0) {
+            LW("Timeout waiting for %s\n", path);
+            return;
+        }
+
+        /* Only used as a wakeup, the node is checked again anyway. */
+        char events[1024];
+        read(inotify_fd, events, sizeof(events));
+        remaining -= ns2ms(systemTime(SYSTEM_TIME_MONOTONIC)) - start;
+    }
+
+    L("Input device %s is ready\n", path);
+}
+
 int suinput_open(const char* device_name, const struct input_id* id, int width, int height)
 {
     int original_errno = 0;
     int uinput_fd = -1;
+    int inotify_fd = -1;
     struct uinput_user_dev user_dev;
     unsigned int i;
 
@@ -88,6 +167,16 @@ int suinput_open(const char* device_name, const struct input_id* id, int width,
     if (ioctl(uinput_fd, UI_SET_ABSBIT, ABS_Y) == -1)
         goto err;
 
+    /* Configure device to track multiple contacts in slots (MT protocol B). */
+    if (ioctl(uinput_fd, UI_SET_ABSBIT, ABS_MT_SLOT) == -1)
+        goto err;
+    if (ioctl(uinput_fd, UI_SET_ABSBIT, ABS_MT_TRACKING_ID) == -1)
+        goto err;
+    if (ioctl(uinput_fd, UI_SET_ABSBIT, ABS_MT_POSITION_X) == -1)
+        goto err;
+    if (ioctl(uinput_fd, UI_SET_ABSBIT, ABS_MT_POSITION_Y) == -1)
+        goto err;
+
     /* Configure device as a touch device with pointer support */
     if (ioctl(uinput_fd, UI_SET_PROPBIT, INPUT_PROP_POINTER) == -1)
         goto err;
@@ -114,26 +203,40 @@ int suinput_open(const char* device_name, const struct input_id* id, int width,
     user_dev.absmax[ABS_X] = width;
     user_dev.absmin[ABS_Y] = 0;
     user_dev.absmax[ABS_Y] = height;
+    user_dev.absmin[ABS_MT_SLOT] = 0;
+    user_dev.absmax[ABS_MT_SLOT] = SUINPUT_MAX_CONTACTS - 1;
+    user_dev.absmin[ABS_MT_TRACKING_ID] = 0;
+    user_dev.absmax[ABS_MT_TRACKING_ID] = 0xFFFF;
+    user_dev.absmin[ABS_MT_POSITION_X] = 0;
+    user_dev.absmax[ABS_MT_POSITION_X] = width;
+    user_dev.absmin[ABS_MT_POSITION_Y] = 0;
+    user_dev.absmax[ABS_MT_POSITION_Y] = height;
 
     if (write(uinput_fd, &user_dev, sizeof(user_dev)) != sizeof(user_dev))
         goto err;
 
+    /*
+  Creating succesfully an uinput device does not guarantee that the device
+  is ready to process input events, its node is created asynchronously by
+  ueventd. Instead of a fixed delay, wait until the node shows up.
+  */
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd >= 0 && inotify_add_watch(inotify_fd, "/dev/input", IN_CREATE | IN_ATTRIB) < 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+
     if (ioctl(uinput_fd, UI_DEV_CREATE) == -1)
         goto err;
 
-    /*
-  The reason for generating a small delay is that creating succesfully
-  an uinput device does not guarantee that the device is ready to process
-  input events. It's probably due the asynchronous nature of the udev.
-  However, my experiments show that the device is not ready to process input
-  events even after a device creation event is received from udev.
-  */
+    suinput_wait_ready(uinput_fd, inotify_fd);
+    if (inotify_fd >= 0)
+        close(inotify_fd);
 
-    sleep(2);
     return uinput_fd;
 
     err:
-    L("Failed opening uinput for device %s...\n", device_name);
+    LE("Failed opening uinput for device %s...\n", device_name);
 
     /*
     At this point, errno is set for some reason. However, cleanup-actions
@@ -144,6 +247,8 @@ int suinput_open(const char* device_name, const struct input_id* id, int width,
 
     /* Cleanup. */
     close(uinput_fd); /* Might fail, but we don't care anymore at this point. */
+    if (inotify_fd >= 0)
+        close(inotify_fd);
 
     errno = original_errno;
     return -1;
@@ -152,13 +257,9 @@ int suinput_open(const char* device_name, const struct input_id* id, int width,
 int suinput_close(int uinput_fd)
 {
     /*
-    Sleep before destroying the device because there still can be some
-    unprocessed events. This is not the right way, but I am still
-    looking for better ways. The question is: how to know whether there
-    are any unprocessed uinput events?
+    There is no way to know whether the reader processed all events, the
+    caller has to give recent events some time before destroying the device.
     */
-    sleep(2);
-
     if (ioctl(uinput_fd, UI_DEV_DESTROY) == -1) {
         close(uinput_fd);
         return -1;
@@ -194,3 +295,53 @@ int suinput_release(int uinput_fd, uint16_t code)
 {
     return suinput_write(uinput_fd, EV_KEY, code, 0);
 }
+
+void suinput_batch_init(struct suinput_batch* batch, int uinput_fd)
+{
+    batch->uinput_fd = uinput_fd;
+    batch->count = 0;
+    batch->full = NULL;
+}
+
+int suinput_batch_add(struct suinput_batch* batch, uint16_t type, uint16_t code, int32_t value)
+{
+    if (batch->count == SUINPUT_BATCH_SIZE) {
+        if (batch->full != NULL)
+            batch->full(batch);
+        else if (suinput_batch_flush(batch) == -1)
+            return -1;
+    }
+
+    struct input_event* event = &batch->events[batch->count++];
+    memset(event, 0, sizeof(*event));
+    event->type = type;
+    event->code = code;
+    event->value = value;
+    return 0;
+}
+
+int suinput_batch_syn(struct suinput_batch* batch)
+{
+    return suinput_batch_add(batch, EV_SYN, SYN_REPORT, 0);
+}
+
+int suinput_batch_flush(struct suinput_batch* batch)
+{
+    if (batch->count == 0)
+        return 0;
+
+    /* All events of the batch happened at the same moment. */
+    struct timeval now;
+    gettimeofday(&now, 0);
+    for (int i = 0; i < batch->count; i++)
+        batch->events[i].time = now;
+
+    ssize_t size = batch->count * sizeof(struct input_event);
+    ssize_t written = write(batch->uinput_fd, batch->events, size);
+    batch->count = 0;
+
+    if (written != size)
+        return -1;
+
+    return 0;
+}
@@ -25,6 +25,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <linux/input.h>
 #include <linux/uinput.h>
 
+/*
+  Number of simultaneous contacts of the multi-touch device (MT protocol B).
+*/
+#define SUINPUT_MAX_CONTACTS 10
+
 /*
   Creates and opens a connection to the event device. Returns an uinput file
   descriptor on success. On error, -1 is returned, and errno is set
@@ -71,4 +76,44 @@ int suinput_press(int uinput_fd, uint16_t code);
 */
 int suinput_release(int uinput_fd, uint16_t code);
 
+/*
+  Events collected to be written with a single system call. A batch
+  usually holds one or more complete reports, each terminated by
+  SYN_REPORT.
+*/
+#define SUINPUT_BATCH_SIZE 64
+
+struct suinput_batch {
+    int uinput_fd;
+    int count;
+    struct input_event events[SUINPUT_BATCH_SIZE];
+
+    /* Takes over a full batch and empties it, flushed when NULL. */
+    void (*full)(struct suinput_batch* batch);
+};
+
+/*
+  Prepares an empty batch for the given event device.
+*/
+void suinput_batch_init(struct suinput_batch* batch, int uinput_fd);
+
+/*
+  Appends an event to the batch. A full batch is handed to its full
+  callback first, or flushed without one. Returns 0 on success. On error,
+  -1 is returned, and errno is set appropriately.
+*/
+int suinput_batch_add(struct suinput_batch* batch, uint16_t type, uint16_t code, int32_t value);
+
+/*
+  Terminates the current report by appending SYN_REPORT.
+*/
+int suinput_batch_syn(struct suinput_batch* batch);
+
+/*
+  Writes all collected events at once, sharing a single timestamp, and
+  empties the batch. Returns 0 on success. On error, -1 is returned, and
+  errno is set appropriately.
+*/
+int suinput_batch_flush(struct suinput_batch* batch);
+
 #endif /* SUINPUT_H */
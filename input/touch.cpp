@@ -0,0 +1,155 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common.h"
+#include "touch.h"
+
+struct touchSlot
+{
+    void* owner;
+    int id;
+    bool active;    // staged state
+    bool reported;  // state the device knows about
+    int trackingId;
+    int x;
+    int y;
+    bool changed;
+};
+
+static touchSlot slots[SUINPUT_MAX_CONTACTS];
+static int nextTrackingId = 0;
+
+static touchSlot* findSlot(void* owner, int id)
+{
+    for (int i = 0; i < SUINPUT_MAX_CONTACTS; i++)
+    {
+        if (slots[i].active && slots[i].owner == owner && slots[i].id == id) { return &slots[i]; }
+    }
+
+    return NULL;
+}
+
+static touchSlot* allocateSlot(void* owner, int id)
+{
+    for (int i = 0; i < SUINPUT_MAX_CONTACTS; i++)
+    {
+        // a slot released in the same report still has to send its release
+        if (!slots[i].active && !slots[i].reported)
+        {
+            slots[i].owner = owner;
+            slots[i].id = id;
+            return &slots[i];
+        }
+    }
+
+    return NULL;
+}
+
+void setContact(void* owner, int id, bool down, int x, int y)
+{
+    touchSlot* slot = findSlot(owner, id);
+    if (slot == NULL)
+    {
+        if (!down) { return; }
+
+        slot = allocateSlot(owner, id);
+        if (slot == NULL)
+        {
+            LW("No free touch slot for contact %d\n", id);
+            return;
+        }
+    }
+
+    slot->changed |= (slot->active != down || slot->x != x || slot->y != y);
+    slot->active = down;
+    slot->x = x;
+    slot->y = y;
+}
+
+void releaseContacts(void* owner)
+{
+    for (int i = 0; i < SUINPUT_MAX_CONTACTS; i++)
+    {
+        if (slots[i].active && slots[i].owner == owner)
+        {
+            slots[i].active = false;
+            slots[i].changed = true;
+        }
+    }
+}
+
+void commitContacts(struct suinput_batch* batch)
+{
+    bool changed = false;
+    bool wasTouching = false;
+    for (int i = 0; i < SUINPUT_MAX_CONTACTS; i++)
+    {
+        changed |= slots[i].changed;
+        wasTouching |= slots[i].reported;
+    }
+
+    if (!changed) { return; }
+
+    // every active contact is part of each report, so dropping an older
+    // motion report while coalescing never loses the position of a finger
+    touchSlot* primary = NULL;
+    for (int i = 0; i < SUINPUT_MAX_CONTACTS; i++)
+    {
+        touchSlot* slot = &slots[i];
+        if (!slot->active && !slot->reported)
+        {
+            slot->changed = false;
+            continue;
+        }
+
+        suinput_batch_add(batch, EV_ABS, ABS_MT_SLOT, i);
+        if (slot->active)
+        {
+            if (!slot->reported)
+            {
+                slot->trackingId = nextTrackingId;
+                nextTrackingId = (nextTrackingId + 1) & 0xFFFF;
+                suinput_batch_add(batch, EV_ABS, ABS_MT_TRACKING_ID, slot->trackingId);
+            }
+
+            suinput_batch_add(batch, EV_ABS, ABS_MT_POSITION_X, slot->x);
+            suinput_batch_add(batch, EV_ABS, ABS_MT_POSITION_Y, slot->y);
+            if (primary == NULL) { primary = slot; }
+        }
+        else
+        {
+            suinput_batch_add(batch, EV_ABS, ABS_MT_TRACKING_ID, -1);
+        }
+
+        slot->reported = slot->active;
+        slot->changed = false;
+    }
+
+    // single touch emulation follows the first contact
+    if (primary != NULL)
+    {
+        suinput_batch_add(batch, EV_ABS, ABS_X, primary->x);
+        suinput_batch_add(batch, EV_ABS, ABS_Y, primary->y);
+    }
+
+    bool touching = (primary != NULL);
+    if (touching != wasTouching) { suinput_batch_add(batch, EV_KEY, BTN_TOUCH, touching ? 1 : 0); }
+
+    suinput_batch_syn(batch);
+}
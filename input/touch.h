@@ -0,0 +1,42 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef TOUCH_H
+#define TOUCH_H
+
+#include "suinput.h"
+
+// contact ids reserved for the RFB pointer and the emulated second finger
+#define POINTER_CONTACT -1
+#define GESTURE_CONTACT -2
+
+typedef struct _touchPoint
+{
+    int id;
+    bool down;
+    int x;
+    int y;
+} touchPoint;
+
+// contacts are staged per owner (client) and written as one MT protocol B report
+void setContact(void* owner, int id, bool down, int x, int y);
+void releaseContacts(void* owner);
+void commitContacts(struct suinput_batch* batch);
+
+#endif
@@ -0,0 +1,194 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <limits.h>
+#include <sys/eventfd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "common.h"
+#include "flinger.h"
+#include "capture.h"
+#include "framedump.h"
+#include "metrics.h"
+#include "trace.h"
+
+extern screenFormat screenformat;
+
+static unsigned int* frontBuffer = NULL;
+static unsigned int* backBuffer = NULL;
+static sraRegionPtr backDirty = NULL;
+static bool backChanged = false;
+static nsecs_t backTime = 0;
+static nsecs_t frontTime = 0;
+static nsecs_t latestTime = 0;
+static uint32_t generation = 0;
+
+static int captureFd = -1;
+static std::atomic<bool> running(false);
+static std::atomic<bool> busy(false);
+
+static std::mutex captureMutex;
+static std::condition_variable captureCond;
+static bool captureRequested = false;
+static nsecs_t requestTime = 0;
+static int32_t requestCount = 0;
+
+static bool (*captureSource)(unsigned int*, sraRegionPtr) = readBuffer;
+
+static void captureThread()
+{
+    while (running)
+    {
+        {
+            std::unique_lock<std::mutex> lock(captureMutex);
+            captureCond.wait(lock, [] { return captureRequested || !running; });
+            captureRequested = false;
+        }
+
+        if (!running) { break; }
+
+        // the main thread does not touch the back buffer until it got notified
+        {
+            TRACE_SCOPE("vncd:capture");
+            backTime = systemTime(SYSTEM_TIME_MONOTONIC);
+            backChanged = captureSource(backBuffer, backDirty);
+            if (backChanged) { dumpFrame(backBuffer, backDirty, backTime); }
+        }
+
+        uint64_t ready = 1;
+        if (write(captureFd, &ready, sizeof(ready)) != sizeof(ready))
+        {
+            LE("Failed signalling captured frame (errno %d)\n", errno);
+        }
+    }
+}
+
+int initCapture(void)
+{
+    size_t size = screenformat.width * screenformat.height * screenformat.bitsPerPixel / CHAR_BIT;
+    frontBuffer = (unsigned int*) calloc(1, size);
+    backBuffer = (unsigned int*) calloc(1, size);
+    if (frontBuffer == NULL || backBuffer == NULL)
+    {
+        LE("Failed allocating capture buffers\n");
+        return -1;
+    }
+
+    captureFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (captureFd < 0)
+    {
+        LE("Failed creating capture eventfd (errno %d)\n", errno);
+        return -1;
+    }
+
+    backDirty = sraRgnCreate();
+    running = true;
+    std::thread(captureThread).detach();
+
+    return 0;
+}
+
+// replaces the screen before initCapture(), the source fills the buffer and its changes
+void setCaptureSource(bool (*source)(unsigned int* buffer, sraRegionPtr dirty))
+{
+    captureSource = source;
+}
+
+unsigned int* getFrontBuffer(void)
+{
+    return frontBuffer;
+}
+
+int getCaptureFd(void)
+{
+    return captureFd;
+}
+
+bool isCaptureBusy(void)
+{
+    return busy;
+}
+
+void requestCapture(void)
+{
+    if (busy) { return; }
+    busy = true;
+    requestTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    traceAsyncBegin("vncd:frame", ++requestCount);
+
+    std::lock_guard<std::mutex> lock(captureMutex);
+    captureRequested = true;
+    captureCond.notify_one();
+}
+
+// returns the new front buffer if the captured frame changed, NULL otherwise
+unsigned int* takeCapture(sraRegionPtr dirty)
+{
+    uint64_t ready;
+    if (read(captureFd, &ready, sizeof(ready)) != sizeof(ready) || !busy)
+    {
+        return NULL;
+    }
+
+    busy = false;
+    traceAsyncEnd("vncd:frame", requestCount);
+    observeDuration(METRIC_CAPTURE_LATENCY, systemTime(SYSTEM_TIME_MONOTONIC) - requestTime);
+    latestTime = backTime;
+    if (!backChanged) { return NULL; }
+
+    // the back buffer holds the complete new frame, the old front is overwritten next time
+    unsigned int* frame = backBuffer;
+    backBuffer = frontBuffer;
+    frontBuffer = frame;
+    frontTime = backTime;
+    generation++;
+
+    sraRgnMakeEmpty(dirty);
+    sraRgnOr(dirty, backDirty);
+    return frontBuffer;
+}
+
+// when the composition of the front buffer was requested from the compositor
+nsecs_t getCaptureTime(void)
+{
+    return frontTime;
+}
+
+// when the latest capture was requested, whether the screen changed or not
+nsecs_t getLatestCaptureTime(void)
+{
+    return latestTime;
+}
+
+// counts the front buffers, unchanged captures keep the previous one
+uint32_t getFrameGeneration(void)
+{
+    return generation;
+}
+
+void closeCapture(void)
+{
+    // the thread might be blocked in the compositor, let it run out on its own
+    running = false;
+    captureCond.notify_one();
+}
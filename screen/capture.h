@@ -0,0 +1,45 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+#include <utils/Timers.h>
+
+extern "C" {
+    #include "rfb/rfbregion.h"
+}
+
+// screen capturing on a separate thread into a back buffer,
+// completion is signalled through an eventfd
+void setCaptureSource(bool (*source)(unsigned int* buffer, sraRegionPtr dirty));
+int initCapture(void);
+unsigned int* getFrontBuffer(void);
+int getCaptureFd(void);
+bool isCaptureBusy(void);
+void requestCapture(void);
+unsigned int* takeCapture(sraRegionPtr dirty);
+nsecs_t getCaptureTime(void);
+nsecs_t getLatestCaptureTime(void);
+uint32_t getFrameGeneration(void);
+void closeCapture(void);
+
+#endif
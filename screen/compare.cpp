@@ -0,0 +1,75 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <string.h>
+
+#include "compare.h"
+
+static void addDirtyRect(sraRegionPtr dirty, int x1, int y1, int x2, int y2)
+{
+    sraRegionPtr rect = sraRgnCreateRect(x1, y1, x2, y2);
+    sraRgnOr(dirty, rect);
+    sraRgnDestroy(rect);
+}
+
+// changed tiles next to each other in a row are added as a single rectangle
+void compareTiles(const uint8_t* current, uint8_t* previous, int width, int height, int bytesPerPixel, sraRegionPtr dirty)
+{
+    size_t stride = width * bytesPerPixel;
+
+    for (int ty = 0; ty < height; ty += TILE_SIZE)
+    {
+        int th = (height - ty < TILE_SIZE) ? height - ty : TILE_SIZE;
+        int runStart = -1;
+
+        for (int tx = 0; tx < width; tx += TILE_SIZE)
+        {
+            int tw = (width - tx < TILE_SIZE) ? width - tx : TILE_SIZE;
+            size_t offset = ty * stride + tx * bytesPerPixel;
+            size_t len = tw * bytesPerPixel;
+
+            int y = 0;
+            while (y < th && memcmp(current + offset + y * stride, previous + offset + y * stride, len) == 0)
+            {
+                y++;
+            }
+
+            if (y < th)
+            {
+                // rows above the first difference are already equal
+                for (; y < th; y++)
+                {
+                    memcpy(previous + offset + y * stride, current + offset + y * stride, len);
+                }
+
+                if (runStart < 0) { runStart = tx; }
+            }
+            else if (runStart >= 0)
+            {
+                addDirtyRect(dirty, runStart, ty, tx, ty + th);
+                runStart = -1;
+            }
+        }
+
+        if (runStart >= 0)
+        {
+            addDirtyRect(dirty, runStart, ty, width, ty + th);
+        }
+    }
+}
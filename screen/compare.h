@@ -0,0 +1,37 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <stdint.h>
+
+extern "C" {
+    #include "rfb/rfbregion.h"
+}
+
+// edge length of the squares used for change detection
+#define TILE_SIZE 64
+
+// adds the tiles of the frame which differ from the previous one to the region
+// and copies them over, so the previous frame is up to date afterwards;
+// only depends on libvncserver, the benchmark uses it on the host as well
+void compareTiles(const uint8_t* current, uint8_t* previous, int width, int height, int bytesPerPixel, sraRegionPtr dirty);
+
+#endif
@@ -28,11 +28,15 @@
 
 #include "common.h"
 #include "flinger.h"
+#include "compare.h"
+#include "metrics.h"
+#include "trace.h"
 
 using namespace android;
 using android::status_t;
 
 static const int COMPONENT_YUV = 0xFF;
+
 extern screenFormat screenformat;
 
 sp<IBinder> display;
@@ -131,13 +135,13 @@ static const Info* gGetPixelFormatTable(size_t* numEntries) {
 
 status_t getPixelFormatInformation(PixelFormat format, PixelFormatInformation* info)
 {
-    L("Retrieving pixel information with format %d\n", format);
+    LD("Retrieving pixel information with format %d\n", format);
 
     // test if we use fkms to adjust color space
     char value[PROPERTY_VALUE_MAX];
     property_get("persist.rpi.vc4.state", value, NULL);
     if (value[0] == '1') {
-       L("Change format to %d because of fkms\n", format);
+       LD("Change format to %d because of fkms\n", format);
        format = HAL_PIXEL_FORMAT_BGRA_8888;
     }
 
@@ -149,43 +153,43 @@ status_t getPixelFormatInformation(PixelFormat format, PixelFormatInformation* i
 
     switch (format) {
         case HAL_PIXEL_FORMAT_RGBA_8888: // 4x8-bit RGBA
-            L("detected HAL_PIXEL_FORMAT_RGBA_8888\n");
+            LD("detected HAL_PIXEL_FORMAT_RGBA_8888\n");
             break;
 
         case HAL_PIXEL_FORMAT_RGBX_8888: // 4x8-bit RGB0
-            L("detected HAL_PIXEL_FORMAT_RGBX_8888\n");
+            LD("detected HAL_PIXEL_FORMAT_RGBX_8888\n");
             break;
 
         case HAL_PIXEL_FORMAT_RGB_888: // 3x8-bit RGB
-            L("detected HAL_PIXEL_FORMAT_RGB_888\n");
+            LD("detected HAL_PIXEL_FORMAT_RGB_888\n");
             break;
 
         case HAL_PIXEL_FORMAT_RGB_565: // 16-bit RGB
-            L("detected HAL_PIXEL_FORMAT_RGB_565\n");
+            LD("detected HAL_PIXEL_FORMAT_RGB_565\n");
             break;
 
         case HAL_PIXEL_FORMAT_BGRA_8888: // 4x8-bit BGRA
-            L("detected HAL_PIXEL_FORMAT_BGRA_8888\n");
+            LD("detected HAL_PIXEL_FORMAT_BGRA_8888\n");
             break;
 
         case HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED: // 16-bit ARGB
-            L("detected HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED\n");
+            LD("detected HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED\n");
             break;
 
         case HAL_PIXEL_FORMAT_BLOB: // 16-bit ARGB
-            L("detected HAL_PIXEL_FORMAT_BLOB\n");
+            LD("detected HAL_PIXEL_FORMAT_BLOB\n");
             break;
 
         case PIXEL_FORMAT_RGBA_5551: // 16-bit ARGB
-            L("detected PIXEL_FORMAT_RGBA_5551\n");
+            LD("detected PIXEL_FORMAT_RGBA_5551\n");
             break;
 
         case PIXEL_FORMAT_RGBA_4444: // 16-bit ARGB
-            L("detected PIXEL_FORMAT_RGBA_4444\n");
+            LD("detected PIXEL_FORMAT_RGBA_4444\n");
             break;
 
         default:
-            L("Unknown pixel FORMAT!\n");
+            LW("Unknown pixel FORMAT!\n");
             break;
     }
 
@@ -193,12 +197,12 @@ status_t getPixelFormatInformation(PixelFormat format, PixelFormatInformation* i
     switch (format) {
     case HAL_PIXEL_FORMAT_YCbCr_422_SP:
     case HAL_PIXEL_FORMAT_YCbCr_422_I:
-        L("detected HAL_PIXEL_FORMAT_YCbCr_422\n");
+        LD("detected HAL_PIXEL_FORMAT_YCbCr_422\n");
         info->bitsPerPixel = 16;
         goto done;
     case HAL_PIXEL_FORMAT_YCrCb_420_SP:
     case HAL_PIXEL_FORMAT_YV12:
-        L("detected HAL_PIXEL_FORMAT_Y*\n");
+        LD("detected HAL_PIXEL_FORMAT_Y*\n");
         info->bitsPerPixel = 12;
      done:
         info->format = format;
@@ -218,7 +222,7 @@ status_t getPixelFormatInformation(PixelFormat format, PixelFormatInformation* i
         return BAD_INDEX;
     }
 
-    L("Filling info struct\n");
+    LD("Filling info struct\n");
     info->format = format;
     info->bytesPerPixel = i->size;
     info->bitsPerPixel  = i->bitsPerPixel;
@@ -261,7 +265,7 @@ void initScreenFormat()
     cmpBuffer = (unsigned int*) malloc(screenformat.size);
     if (!cmpBuffer)
     {
-        L("Failed allocating comparison buffer\n");
+        LE("Failed allocating comparison buffer\n");
     }
 }
 
@@ -277,30 +281,30 @@ int initDisplay(void)
 {
     displayId = SurfaceComposerClient::getInternalDisplayId();
     if (!displayId) {
-        L("Failed to get token for internal display\n");
+        LE("Failed to get token for internal display\n");
         return -1;
     }
 
     display = SurfaceComposerClient::getPhysicalDisplayToken(*displayId);
     if (display == NULL) {
-        L("Didn't get display with id: %lu\n", *displayId);
+        LE("Didn't get display with id: %lu\n", *displayId);
         return -1;
     }
 
     status_t error = ScreenshotClient::capture(*displayId, &dataspace, &outBuffer);
     if (outBuffer == nullptr) {
-        L("Didn't get buffer for display: %lu (error: %d)\n", *displayId, error);
+        LE("Didn't get buffer for display: %lu (error: %d)\n", *displayId, error);
         return -1;
     }
 
     if (error != NO_ERROR) {
-        L("Flinger initialization failed\n");
+        LE("Flinger initialization failed\n");
         return -1;
     }
 
     initScreenFormat();
     if (screenformat.width <= 0) {
-        L("Received a bad screen size from flinger\n");
+        LE("Received a bad screen size from flinger\n");
         return -1;
     }
 
@@ -316,28 +320,47 @@ android::ui::Rotation getScreenRotation()
     return displayState.orientation;
 }
 
-bool readBuffer(unsigned int* buffer)
+nsecs_t getRefreshPeriod()
+{
+    DisplayConfig config;
+    status_t error = SurfaceComposerClient::getActiveDisplayConfig(display, &config);
+    if (error != NO_ERROR || config.refreshRate <= 0) {
+        LE("Failed to get refresh rate of display (error: %d), assuming 60 Hz\n", error);
+        return ms2ns(16);
+    }
+
+    return (nsecs_t) (1e9 / config.refreshRate);
+}
+
+bool readBuffer(unsigned int* buffer, sraRegionPtr dirty)
 {
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    traceBegin("vncd:screenshot");
     ScreenshotClient::capture(*displayId, &dataspace, &outBuffer);
+    traceEnd();
 
     void* base = 0;
     int size = screenformat.width * screenformat.height * screenformat.bitsPerPixel / CHAR_BIT;
 
+    traceBegin("vncd:copy");
     outBuffer->lock(GraphicBuffer::USAGE_SW_READ_OFTEN, &base);
     memcpy(buffer, base, size);
     outBuffer->unlock();
+    traceEnd();
 
-    if (memcmp(cmpBuffer, buffer, size) == 0)
-    {
-        // no UI changes detected
-        return false;
-    }
-    else
-    {
-        // save UI changes for next iteration
-        memcpy(cmpBuffer, buffer, size);
-        return true;
-    }
+    nsecs_t copied = systemTime(SYSTEM_TIME_MONOTONIC);
+    countMetric(METRIC_FRAMES_CAPTURED);
+    observeDuration(METRIC_CAPTURE_TIME, copied - start);
+
+    traceBegin("vncd:compare");
+    sraRgnMakeEmpty(dirty);
+    compareTiles((const uint8_t*) buffer, (uint8_t*) cmpBuffer, screenformat.width, screenformat.height,
+        screenformat.bitsPerPixel / CHAR_BIT, dirty);
+    traceEnd();
+    observeDuration(METRIC_COMPARE_TIME, systemTime(SYSTEM_TIME_MONOTONIC) - copied);
+
+    // no UI changes detected if the region stays empty
+    return !sraRgnEmpty(dirty);
 }
 
 void closeDisplay()
@@ -25,6 +25,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <ui/DisplayConfig.h>
 #include <ui/DisplayState.h>
+#include <utils/Timers.h>
+
+extern "C" {
+    #include "rfb/rfbregion.h"
+}
 
 typedef struct _screenFormat
 {
@@ -52,7 +57,8 @@ typedef struct _screenFormat
 int initFlinger(void);
 int initDisplay(void);
 android::ui::Rotation getScreenRotation(void);
-bool readBuffer(unsigned int* buffer);
+nsecs_t getRefreshPeriod(void);
+bool readBuffer(unsigned int* buffer, sraRegionPtr dirty);
 void closeDisplay(void);
 void closeFlinger(void);
 
@@ -0,0 +1,268 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <limits.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "common.h"
+#include "flinger.h"
+#include "framefile.h"
+#include "framedump.h"
+#include "metrics.h"
+
+extern screenFormat screenformat;
+
+// frames waiting for the writer, more are dropped
+#define DUMP_QUEUE 4
+
+// interval of full frames, so a dump can be cut and replayed from there (s)
+#define KEYFRAME_INTERVAL 5
+
+// how long the last frame of a replay is held before it starts over (s)
+#define REPLAY_PAUSE 1
+
+struct dumpedFrame
+{
+    uint8_t* payload;
+    size_t size;
+    uint32_t rectCount;
+    uint32_t flags;
+    int64_t timestamp;
+};
+
+static frameWriter* writer = NULL;
+static frameFileHeader format;
+static nsecs_t dumpStart = 0;
+static nsecs_t lastKeyframe = 0;
+static bool forceKeyframe = true;
+static std::atomic<uint32_t> dropped(0);
+
+static std::mutex dumpMutex;
+static std::condition_variable dumpCond;
+static std::deque<dumpedFrame> dumpQueue;
+static std::thread dumpThread;
+static bool dumping = false;
+
+static frameReader* reader = NULL;
+static uint8_t* replayFrame = NULL;
+static uint32_t replayNext = 0;
+static nsecs_t replayStart = 0;
+
+static void writeFrames()
+{
+    bool failed = false;
+    while (true)
+    {
+        dumpedFrame frame;
+        {
+            std::unique_lock<std::mutex> lock(dumpMutex);
+            dumpCond.wait(lock, [] { return !dumpQueue.empty() || !dumping; });
+            if (dumpQueue.empty()) { break; }
+
+            frame = dumpQueue.front();
+            dumpQueue.pop_front();
+        }
+
+        if (!failed && !writeFrame(writer, frame.payload, frame.size, frame.rectCount, frame.flags, frame.timestamp))
+        {
+            LE("Failed writing frame dump (errno %d), dropping further frames\n", errno);
+            failed = true;
+        }
+        free(frame.payload);
+    }
+}
+
+int initFrameDump(const char* path)
+{
+    memset(&format, 0, sizeof(format));
+    format.width = screenformat.width;
+    format.height = screenformat.height;
+    format.bitsPerPixel = screenformat.bitsPerPixel;
+    format.redShift = screenformat.redShift;
+    format.greenShift = screenformat.greenShift;
+    format.blueShift = screenformat.blueShift;
+    format.alphaShift = screenformat.alphaShift;
+    format.redMax = screenformat.redMax;
+    format.greenMax = screenformat.greenMax;
+    format.blueMax = screenformat.blueMax;
+    format.alphaMax = screenformat.alphaMax;
+    format.startTime = systemTime(SYSTEM_TIME_REALTIME);
+
+    writer = openFrameWriter(path, &format);
+    if (writer == NULL)
+    {
+        LE("Failed creating frame dump %s (errno %d)\n", path, errno);
+        return -1;
+    }
+
+    dumpStart = systemTime(SYSTEM_TIME_MONOTONIC);
+    dumping = true;
+    dumpThread = std::thread(writeFrames);
+
+    L("Dumping captured frames to %s\n", path);
+    return 0;
+}
+
+// called on the capture thread with a frame that changed
+void dumpFrame(const unsigned int* buffer, sraRegionPtr dirty, nsecs_t time)
+{
+    if (writer == NULL) { return; }
+
+    {
+        std::lock_guard<std::mutex> lock(dumpMutex);
+        if (dumpQueue.size() >= DUMP_QUEUE)
+        {
+            // the next frame has to repaint what this one changed
+            dropped++;
+            forceKeyframe = true;
+            return;
+        }
+    }
+
+    bool keyframe = forceKeyframe || time - lastKeyframe >= s2ns(KEYFRAME_INTERVAL);
+    sraRegionPtr region = keyframe ? NULL : dirty;
+
+    dumpedFrame frame;
+    frame.size = getPackedSize(&format, region, &frame.rectCount);
+    frame.payload = (uint8_t*) malloc(frame.size);
+    if (frame.payload == NULL)
+    {
+        dropped++;
+        forceKeyframe = true;
+        return;
+    }
+
+    packFrame(&format, (const uint8_t*) buffer, region, frame.payload);
+    frame.flags = keyframe ? FRAME_KEYFRAME : 0;
+    frame.timestamp = (time > dumpStart) ? time - dumpStart : 0;
+
+    std::lock_guard<std::mutex> lock(dumpMutex);
+    if (!dumping)
+    {
+        free(frame.payload);
+        return;
+    }
+
+    dumpQueue.push_back(frame);
+    dumpCond.notify_one();
+
+    if (keyframe)
+    {
+        lastKeyframe = time;
+        forceKeyframe = false;
+    }
+}
+
+void closeFrameDump(void)
+{
+    if (writer == NULL) { return; }
+
+    // queued frames are still written
+    {
+        std::lock_guard<std::mutex> lock(dumpMutex);
+        dumping = false;
+        dumpCond.notify_one();
+    }
+    dumpThread.join();
+
+    uint32_t frames = getWrittenFrames(writer);
+    if (!closeFrameWriter(writer)) { LE("Failed finishing frame dump (errno %d)\n", errno); }
+    writer = NULL;
+
+    L("Frame dump closed with %u frames, %u dropped\n", frames, dropped.load());
+}
+
+int initReplay(const char* path)
+{
+    reader = openFrameReader(path);
+    if (reader == NULL)
+    {
+        LE("Failed opening frame dump %s\n", path);
+        return -1;
+    }
+
+    uint32_t count = getFrameCount(reader);
+    if (count == 0)
+    {
+        LE("Frame dump %s holds no frames\n", path);
+        return -1;
+    }
+
+    const frameFileHeader* header = getFrameFormat(reader);
+    screenformat.width = header->width;
+    screenformat.height = header->height;
+    screenformat.bitsPerPixel = header->bitsPerPixel;
+    screenformat.size = header->width * header->height * header->bitsPerPixel / CHAR_BIT;
+    screenformat.redShift = header->redShift;
+    screenformat.greenShift = header->greenShift;
+    screenformat.blueShift = header->blueShift;
+    screenformat.alphaShift = header->alphaShift;
+    screenformat.redMax = header->redMax;
+    screenformat.greenMax = header->greenMax;
+    screenformat.blueMax = header->blueMax;
+    screenformat.alphaMax = header->alphaMax;
+    screenformat.rotation = android::ui::ROTATION_0;
+
+    replayFrame = (uint8_t*) calloc(1, screenformat.size);
+    if (replayFrame == NULL)
+    {
+        LE("Failed allocating replay frame\n");
+        return -1;
+    }
+
+    L("Replaying %u frames (%.1f s) from %s\n", count, getFrameTime(reader, count - 1) / 1e9, path);
+    return 0;
+}
+
+// takes the place of readBuffer, applies every record that is due and starts over after the last
+bool readReplay(unsigned int* buffer, sraRegionPtr dirty)
+{
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (replayStart == 0) { replayStart = now; }
+
+    sraRgnMakeEmpty(dirty);
+    uint32_t count = getFrameCount(reader);
+    while (getFrameTime(reader, replayNext) <= now - replayStart)
+    {
+        if (!applyFrame(reader, replayNext, replayFrame, dirty))
+        {
+            LW("Skipping damaged frame %u of the dump\n", replayNext);
+        }
+
+        // the first record is always a keyframe
+        if (++replayNext == count)
+        {
+            replayNext = 0;
+            replayStart = now + s2ns(REPLAY_PAUSE);
+            break;
+        }
+    }
+
+    countMetric(METRIC_FRAMES_CAPTURED);
+    if (sraRgnEmpty(dirty)) { return false; }
+
+    // the capture buffers take turns, each needs the complete frame
+    memcpy(buffer, replayFrame, screenformat.size);
+    return true;
+}
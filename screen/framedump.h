@@ -0,0 +1,39 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef FRAMEDUMP_H
+#define FRAMEDUMP_H
+
+#include <utils/Timers.h>
+
+extern "C" {
+    #include "rfb/rfbregion.h"
+}
+
+// captured frames are copied on the capture thread and written by a thread of their own,
+// frames are dropped rather than slowing down capturing
+int initFrameDump(const char* path);
+void dumpFrame(const unsigned int* buffer, sraRegionPtr dirty, nsecs_t time);
+void closeFrameDump(void);
+
+// a dump stands in for the screen, frames are shown at the pace they were captured
+int initReplay(const char* path);
+bool readReplay(unsigned int* buffer, sraRegionPtr dirty);
+
+#endif
@@ -0,0 +1,351 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+#include "framefile.h"
+
+// records start at multiples of this, so their headers can be read in place
+#define RECORD_ALIGNMENT 8
+
+#define RECT_HEADER (4 * sizeof(uint16_t))
+
+struct frameWriter
+{
+    int file;
+    frameFileHeader header;
+    uint8_t* compressed;
+    size_t capacity;
+};
+
+struct frameReader
+{
+    uint8_t* data;
+    size_t size;
+    const frameFileHeader* header;
+
+    // offsets of the records, collected when the file is opened
+    size_t* records;
+    uint32_t count;
+
+    uint8_t* payload;
+    size_t capacity;
+};
+
+static size_t alignRecord(size_t size)
+{
+    return (size + RECORD_ALIGNMENT - 1) & ~(size_t) (RECORD_ALIGNMENT - 1);
+}
+
+static bool writeAll(int file, const void* data, size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*) data;
+    while (size > 0)
+    {
+        ssize_t written = write(file, bytes, size);
+        if (written < 0 && errno == EINTR) { continue; }
+        if (written <= 0) { return false; }
+
+        bytes += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+size_t getPackedSize(const frameFileHeader* format, sraRegionPtr dirty, uint32_t* rectCount)
+{
+    int bytesPerPixel = format->bitsPerPixel / 8;
+    if (dirty == NULL)
+    {
+        *rectCount = 1;
+        return RECT_HEADER + (size_t) format->width * format->height * bytesPerPixel;
+    }
+
+    size_t size = 0;
+    *rectCount = 0;
+
+    sraRect rect;
+    sraRectangleIterator* it = sraRgnGetIterator(dirty);
+    while (sraRgnIteratorNext(it, &rect))
+    {
+        size += RECT_HEADER + (size_t) (rect.x2 - rect.x1) * (rect.y2 - rect.y1) * bytesPerPixel;
+        (*rectCount)++;
+    }
+    sraRgnReleaseIterator(it);
+
+    return size;
+}
+
+static uint8_t* packRect(const frameFileHeader* format, const uint8_t* frame, int x1, int y1, int x2, int y2, uint8_t* out)
+{
+    int bytesPerPixel = format->bitsPerPixel / 8;
+    size_t stride = (size_t) format->width * bytesPerPixel;
+    uint16_t rect[4] = { (uint16_t) x1, (uint16_t) y1, (uint16_t) (x2 - x1), (uint16_t) (y2 - y1) };
+    memcpy(out, rect, RECT_HEADER);
+    out += RECT_HEADER;
+
+    size_t length = (size_t) (x2 - x1) * bytesPerPixel;
+    for (int y = y1; y < y2; y++)
+    {
+        memcpy(out, frame + y * stride + x1 * bytesPerPixel, length);
+        out += length;
+    }
+
+    return out;
+}
+
+void packFrame(const frameFileHeader* format, const uint8_t* frame, sraRegionPtr dirty, uint8_t* payload)
+{
+    if (dirty == NULL)
+    {
+        packRect(format, frame, 0, 0, format->width, format->height, payload);
+        return;
+    }
+
+    sraRect rect;
+    sraRectangleIterator* it = sraRgnGetIterator(dirty);
+    while (sraRgnIteratorNext(it, &rect))
+    {
+        payload = packRect(format, frame, rect.x1, rect.y1, rect.x2, rect.y2, payload);
+    }
+    sraRgnReleaseIterator(it);
+}
+
+frameWriter* openFrameWriter(const char* path, const frameFileHeader* format)
+{
+    frameWriter* writer = (frameWriter*) calloc(1, sizeof(frameWriter));
+    if (writer == NULL) { return NULL; }
+
+    writer->header = *format;
+    memcpy(writer->header.magic, FRAME_FILE_MAGIC, sizeof(writer->header.magic));
+    writer->header.version = FRAME_FILE_VERSION;
+    writer->header.headerSize = sizeof(frameFileHeader);
+    writer->header.frameCount = 0;
+
+    writer->file = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (writer->file < 0 || !writeAll(writer->file, &writer->header, sizeof(frameFileHeader)))
+    {
+        if (writer->file >= 0) { close(writer->file); }
+        free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+bool writeFrame(frameWriter* writer, const uint8_t* payload, size_t size, uint32_t rectCount, uint32_t flags, int64_t timestamp)
+{
+    size_t bound = compressBound(size);
+    if (bound > writer->capacity)
+    {
+        uint8_t* compressed = (uint8_t*) realloc(writer->compressed, bound);
+        if (compressed == NULL) { return false; }
+
+        writer->compressed = compressed;
+        writer->capacity = bound;
+    }
+
+    // screen content compresses well already at the fastest level
+    uLongf compressedSize = bound;
+    if (compress2(writer->compressed, &compressedSize, payload, size, Z_BEST_SPEED) != Z_OK) { return false; }
+
+    frameRecord record;
+    memset(&record, 0, sizeof(record));
+    record.magic = FRAME_RECORD_MAGIC;
+    record.flags = flags;
+    record.timestamp = timestamp;
+    record.rectCount = rectCount;
+    record.dataSize = compressedSize;
+    record.rawSize = size;
+
+    static const uint8_t padding[RECORD_ALIGNMENT] = { 0 };
+    size_t total = sizeof(record) + compressedSize;
+    if (!writeAll(writer->file, &record, sizeof(record)) || !writeAll(writer->file, writer->compressed, compressedSize) ||
+        !writeAll(writer->file, padding, alignRecord(total) - total))
+    {
+        return false;
+    }
+
+    writer->header.frameCount++;
+    return true;
+}
+
+uint32_t getWrittenFrames(frameWriter* writer)
+{
+    return writer->header.frameCount;
+}
+
+bool closeFrameWriter(frameWriter* writer)
+{
+    bool result = pwrite(writer->file, &writer->header, sizeof(frameFileHeader), 0) == sizeof(frameFileHeader);
+    result = close(writer->file) == 0 && result;
+
+    free(writer->compressed);
+    free(writer);
+    return result;
+}
+
+// a record cut off by a crash ends the file
+static void indexRecords(frameReader* reader)
+{
+    size_t offset = reader->header->headerSize;
+    size_t capacity = 0;
+    while (offset + sizeof(frameRecord) <= reader->size)
+    {
+        const frameRecord* record = (const frameRecord*) (reader->data + offset);
+        if (record->magic != FRAME_RECORD_MAGIC || offset + sizeof(frameRecord) + record->dataSize > reader->size) { break; }
+
+        if (reader->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 1024;
+            size_t* records = (size_t*) realloc(reader->records, capacity * sizeof(size_t));
+            if (records == NULL) { break; }
+            reader->records = records;
+        }
+
+        reader->records[reader->count++] = offset;
+        offset += alignRecord(sizeof(frameRecord) + record->dataSize);
+    }
+}
+
+frameReader* openFrameReader(const char* path)
+{
+    int file = open(path, O_RDONLY | O_CLOEXEC);
+    if (file < 0) { return NULL; }
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || (size_t) info.st_size < sizeof(frameFileHeader))
+    {
+        close(file);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED) { return NULL; }
+
+    frameReader* reader = (frameReader*) calloc(1, sizeof(frameReader));
+    if (reader == NULL)
+    {
+        munmap(data, info.st_size);
+        return NULL;
+    }
+
+    reader->data = (uint8_t*) data;
+    reader->size = info.st_size;
+    reader->header = (const frameFileHeader*) data;
+
+    const frameFileHeader* header = reader->header;
+    if (memcmp(header->magic, FRAME_FILE_MAGIC, sizeof(header->magic)) != 0 || header->version != FRAME_FILE_VERSION ||
+        header->headerSize < sizeof(frameFileHeader) || header->bitsPerPixel % 8 != 0 || header->bitsPerPixel == 0)
+    {
+        closeFrameReader(reader);
+        return NULL;
+    }
+
+    indexRecords(reader);
+    return reader;
+}
+
+const frameFileHeader* getFrameFormat(frameReader* reader)
+{
+    return reader->header;
+}
+
+uint32_t getFrameCount(frameReader* reader)
+{
+    return reader->count;
+}
+
+int64_t getFrameTime(frameReader* reader, uint32_t index)
+{
+    return ((const frameRecord*) (reader->data + reader->records[index]))->timestamp;
+}
+
+// draws the rectangles of a record into the frame and adds them to the region
+bool applyFrame(frameReader* reader, uint32_t index, uint8_t* frame, sraRegionPtr dirty)
+{
+    const frameRecord* record = (const frameRecord*) (reader->data + reader->records[index]);
+    if (record->rawSize > reader->capacity)
+    {
+        uint8_t* payload = (uint8_t*) realloc(reader->payload, record->rawSize);
+        if (payload == NULL) { return false; }
+
+        reader->payload = payload;
+        reader->capacity = record->rawSize;
+    }
+
+    uLongf size = record->rawSize;
+    if (uncompress(reader->payload, &size, (const uint8_t*) (record + 1), record->dataSize) != Z_OK || size != record->rawSize)
+    {
+        return false;
+    }
+
+    const frameFileHeader* header = reader->header;
+    int bytesPerPixel = header->bitsPerPixel / 8;
+    size_t stride = (size_t) header->width * bytesPerPixel;
+    const uint8_t* in = reader->payload;
+    const uint8_t* end = reader->payload + size;
+
+    for (uint32_t i = 0; i < record->rectCount; i++)
+    {
+        uint16_t rect[4];
+        if (in + RECT_HEADER > end) { return false; }
+        memcpy(rect, in, RECT_HEADER);
+        in += RECT_HEADER;
+
+        size_t length = (size_t) rect[2] * bytesPerPixel;
+        if (rect[0] + rect[2] > header->width || rect[1] + rect[3] > header->height || in + length * rect[3] > end)
+        {
+            return false;
+        }
+
+        for (int y = rect[1]; y < rect[1] + rect[3]; y++)
+        {
+            memcpy(frame + y * stride + rect[0] * bytesPerPixel, in, length);
+            in += length;
+        }
+
+        if (dirty != NULL)
+        {
+            sraRegionPtr area = sraRgnCreateRect(rect[0], rect[1], rect[0] + rect[2], rect[1] + rect[3]);
+            sraRgnOr(dirty, area);
+            sraRgnDestroy(area);
+        }
+    }
+
+    return true;
+}
+
+void closeFrameReader(frameReader* reader)
+{
+    munmap(reader->data, reader->size);
+    free(reader->records);
+    free(reader->payload);
+    free(reader);
+}
@@ -0,0 +1,104 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef FRAMEFILE_H
+#define FRAMEFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+extern "C" {
+    #include "rfb/rfbregion.h"
+}
+
+// Captured frames for offline analysis, in host byte order:
+//
+//   frameFileHeader
+//   frameRecord, payload, padding to 8 bytes
+//   ...
+//
+// The zlib compressed payload lists the rectangles of the record (x, y, w, h
+// as uint16_t), followed by their pixels row by row. Keyframes hold the whole
+// screen, the other records only the tiles which changed since the previous one.
+// Records are self-describing, a file which was not closed can still be read.
+
+#define FRAME_FILE_MAGIC "VNCDFRM1"
+#define FRAME_FILE_VERSION 1
+#define FRAME_RECORD_MAGIC 0x4D415246 // "FRAM"
+#define FRAME_KEYFRAME (1 << 0)
+
+typedef struct _frameFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+
+    uint16_t width;
+    uint16_t height;
+    uint8_t bitsPerPixel;
+
+    // shifts and bits per component, as in screenFormat
+    uint8_t redShift;
+    uint8_t greenShift;
+    uint8_t blueShift;
+    uint8_t alphaShift;
+    uint8_t redMax;
+    uint8_t greenMax;
+    uint8_t blueMax;
+    uint8_t alphaMax;
+    uint8_t pad[3];
+
+    int64_t startTime;   // wall clock when recording started (ns since the epoch)
+    uint32_t frameCount; // set once the file is closed
+    uint32_t reserved[7];
+} frameFileHeader;
+
+typedef struct _frameRecord
+{
+    uint32_t magic;
+    uint32_t flags;
+    int64_t timestamp; // since recording started (ns)
+    uint32_t rectCount;
+    uint32_t dataSize; // compressed payload
+    uint32_t rawSize;
+    uint32_t pad;
+} frameRecord;
+
+struct frameWriter;
+struct frameReader;
+
+// packing only copies, the capture thread hands the result to a writer thread;
+// a NULL region packs the whole frame
+size_t getPackedSize(const frameFileHeader* format, sraRegionPtr dirty, uint32_t* rectCount);
+void packFrame(const frameFileHeader* format, const uint8_t* frame, sraRegionPtr dirty, uint8_t* payload);
+
+frameWriter* openFrameWriter(const char* path, const frameFileHeader* format);
+bool writeFrame(frameWriter* writer, const uint8_t* payload, size_t size, uint32_t rectCount, uint32_t flags, int64_t timestamp);
+uint32_t getWrittenFrames(frameWriter* writer);
+bool closeFrameWriter(frameWriter* writer);
+
+// the file is mapped, records are decompressed on demand
+frameReader* openFrameReader(const char* path);
+const frameFileHeader* getFrameFormat(frameReader* reader);
+uint32_t getFrameCount(frameReader* reader);
+int64_t getFrameTime(frameReader* reader, uint32_t index);
+bool applyFrame(frameReader* reader, uint32_t index, uint8_t* frame, sraRegionPtr dirty);
+void closeFrameReader(frameReader* reader);
+
+#endif
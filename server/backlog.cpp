@@ -0,0 +1,94 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+
+#include "common.h"
+#include "client.h"
+#include "backlog.h"
+#include "trace.h"
+
+// unsent bytes the kernel may hold before the socket stops accepting data
+#define NOTSENT_LOWAT (128 * 1024)
+
+// queue that is always tolerated, independent of the link estimation
+#define MIN_BACKLOG (64 * 1024)
+
+// queueing delay tolerated on top of the round trip
+#define MAX_QUEUE_DELAY 0.1
+
+void initBacklog(rfbClientPtr cl)
+{
+    // keep stale updates in libvncserver instead of the socket buffer,
+    // the next update is then encoded from a newer frame
+    int lowat = NOTSENT_LOWAT;
+    if (setsockopt(cl->sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)) != 0)
+    {
+        LW("Could not limit unsent data for client %s (errno %d)\n", cl->host, errno);
+    }
+}
+
+int getSendBacklog(rfbClientPtr cl)
+{
+    int queued = 0;
+    if (ioctl(cl->sock, SIOCOUTQ, &queued) != 0)
+    {
+        return 0;
+    }
+
+    return queued;
+}
+
+// the queue holds data in flight (one round trip worth) plus data waiting to be sent
+int getAllowedBacklog(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL) { return MIN_BACKLOG; }
+
+    double allowed = state->throughput * (state->rtt / 1000.0 + MAX_QUEUE_DELAY);
+    return (allowed < MIN_BACKLOG) ? MIN_BACKLOG : (int) allowed;
+}
+
+bool isBacklogged(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL) { return false; }
+
+    state->backlog = getSendBacklog(cl);
+    if (state->sendTraced && state->backlog == 0)
+    {
+        traceAsyncEnd("vncd:send", cl->sock);
+        state->sendTraced = false;
+    }
+
+    return state->backlog > getAllowedBacklog(cl);
+}
+
+// the update is handed to the kernel, the slice lasts until the client acknowledged all of it
+void traceSendStarted(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL || state->sendTraced || !isTracing()) { return; }
+
+    traceAsyncBegin("vncd:send", cl->sock);
+    state->sendTraced = true;
+}
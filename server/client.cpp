@@ -0,0 +1,85 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common.h"
+#include "client.h"
+
+static uint32_t nextClientId = 1;
+
+clientState* newClientState(rfbClientPtr cl)
+{
+    clientState* state = (clientState*) calloc(1, sizeof(clientState));
+    if (state == NULL)
+    {
+        LE("Failed allocating state for client %s\n", cl->host);
+        return NULL;
+    }
+
+    state->id = nextClientId++;
+    state->quality = -1;
+    state->compress = -1;
+    state->clientQuality = -1;
+    state->pendingRegion = sraRgnCreate();
+    state->continuousRegion = sraRgnCreate();
+
+    cl->clientData = state;
+    return state;
+}
+
+void addPendingRegion(rfbClientPtr cl, sraRegionPtr region)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL) { return; }
+
+    // frames skipped in the meantime only leave their changed areas behind,
+    // the pixels are always taken from the newest capture
+    if (!sraRgnEmpty(state->pendingRegion)) { state->skippedFrames++; }
+    sraRgnOr(state->pendingRegion, region);
+}
+
+bool hasPendingRegion(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    return state != NULL && !sraRgnEmpty(state->pendingRegion);
+}
+
+void flushPendingRegion(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL) { return; }
+
+    LOCK(cl->updateMutex);
+    sraRgnOr(cl->modifiedRegion, state->pendingRegion);
+    UNLOCK(cl->updateMutex);
+
+    sraRgnMakeEmpty(state->pendingRegion);
+}
+
+void freeClientState(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL) { return; }
+
+    sraRgnDestroy(state->pendingRegion);
+    sraRgnDestroy(state->continuousRegion);
+    free(state->pasteText);
+    free(state->cutText);
+    free(state);
+    cl->clientData = NULL;
+}
@@ -0,0 +1,166 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <stdint.h>
+
+#include <utils/Timers.h>
+
+extern "C" {
+    #include "rfb/rfb.h"
+}
+
+// fences a client may have outstanding
+#define FENCE_HISTORY 16
+
+// keys a client may hold down at the same time
+#define MAX_PRESSED_KEYS 16
+
+typedef struct _pressedKey
+{
+    uint32_t keysym;
+    uint16_t code;
+    uint8_t synthetic; // modifiers pressed on behalf of this key
+    uint8_t withheld;  // modifier the device does not see during a gesture
+} pressedKey;
+
+// buckets of the per-client latency histograms, +Inf is implicit
+#define LATENCY_BUCKETS 12
+
+typedef struct _latencyHistogram
+{
+    uint32_t buckets[LATENCY_BUCKETS + 1];
+    uint32_t count;
+    nsecs_t sum;
+    nsecs_t max;
+} latencyHistogram;
+
+struct fileTransfer;
+
+// per-client state attached to rfbClientRec::clientData
+typedef struct _clientState
+{
+    // tells connections from the same host apart, e.g. behind adb forward
+    uint32_t id;
+
+    // send timing of the update currently in flight
+    nsecs_t updateStart;
+    int sentAtUpdateStart;
+
+    // periodic link sampling
+    nsecs_t lastSample;
+    uint64_t ackedAtSample;
+    int requestsAtSample;
+
+    // link estimation (EWMA)
+    double throughput; // bytes per second
+    double rtt;        // milliseconds
+    double requestRate; // framebuffer update requests per second
+
+    // adaptive quality
+    int tier;
+    nsecs_t tierSince;
+    int quality;       // -1 = lossless
+    int compress;
+    int clientQuality; // level requested by the viewer itself
+
+    // frame pacing
+    nsecs_t frameInterval;
+    nsecs_t nextFrame;
+
+    // changes not yet handed to libvncserver
+    sraRegionPtr pendingRegion;
+    int backlog;
+    bool sendTraced; // a send slice is open until the socket queue drained
+    uint32_t skippedFrames;
+
+    // continuous updates with fence based flow control
+    bool fenceSupported;
+    bool continuousSupported;
+    bool continuousUpdates;
+    sraRegionPtr continuousRegion;
+    bool fencePending;
+    uint32_t fenceSent;
+    uint32_t fenceAcked;
+    nsecs_t fenceTime[FENCE_HISTORY];
+    int fenceBytes[FENCE_HISTORY];
+    double fenceRtt; // milliseconds
+
+    // private multi-touch extension
+    bool multitouchSupported;
+
+    // extended clipboard
+    bool extendedClipboard;
+    uint32_t clipboardCaps;      // actions and formats the client understands
+    uint32_t clipboardTextLimit; // largest text the client accepts unasked
+
+    // cut text message read from the socket as it arrives
+    char cutTextHeader[sz_rfbClientCutTextMsg];
+    int cutTextHeaderRead;
+    char* cutText;
+    int cutTextSize;
+    int cutTextRead;
+    bool cutTextExtended;
+
+    // keyboard
+    pressedKey pressedKeys[MAX_PRESSED_KEYS];
+    int pressedCount;
+    uint8_t heldModifiers; // modifier keys the client holds down
+
+    // two finger gesture of a drag with a modifier held
+    bool leftDown;
+    uint8_t gesture;
+    int gestureX, gestureY;
+
+    // end-to-end latency
+    nsecs_t inputTime;      // oldest input whose effect was not captured yet, 0 if none
+    int inputX, inputY;     // where the effect is expected, -1 for anywhere
+    nsecs_t pendingCapture; // capture time of the oldest change not handed to libvncserver
+    nsecs_t flushedCapture; // same for changes handed over but not sent yet
+    uint32_t unansweredInputs;
+    latencyHistogram inputLatency;
+    latencyHistogram sendLatency;
+    nsecs_t latencyReported;
+
+    // the internal viewer which records the session
+    bool recorder;
+
+    // download streamed by the transfer thread
+    struct fileTransfer* transfer;
+
+    // text typed in a burst, pasted at once
+    char* pasteText;
+    int pasteLength;
+    int pasteCapacity;
+} clientState;
+
+clientState* newClientState(rfbClientPtr cl);
+void addPendingRegion(rfbClientPtr cl, sraRegionPtr region);
+bool hasPendingRegion(rfbClientPtr cl);
+void flushPendingRegion(rfbClientPtr cl);
+void freeClientState(rfbClientPtr cl);
+
+static inline clientState* getClientState(rfbClientPtr cl)
+{
+    return (clientState*) cl->clientData;
+}
+
+#endif
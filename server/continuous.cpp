@@ -0,0 +1,291 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common.h"
+#include "client.h"
+#include "continuous.h"
+
+// data a client may have unprocessed before pushing is paused
+#define MIN_WINDOW (256 * 1024)
+
+static int continuousEncodings[] = { ENCODING_FENCE, ENCODING_CONTINUOUS_UPDATES, 0 };
+static rfbProtocolExtension continuousExtension;
+
+static bool writeMessage(rfbClientPtr cl, const char* buf, int len)
+{
+    LOCK(cl->sendMutex);
+    int result = rfbWriteExact(cl, buf, len);
+    UNLOCK(cl->sendMutex);
+
+    if (result < 0)
+    {
+        LE("Failed writing to client %s\n", cl->host);
+        rfbCloseClient(cl);
+        return false;
+    }
+
+    return true;
+}
+
+static bool sendFence(rfbClientPtr cl, uint32_t flags, uint8_t length, const char* payload)
+{
+    char buf[9 + FENCE_MAX_PAYLOAD];
+    uint32_t flagsBE = Swap32IfLE(flags);
+
+    buf[0] = MSG_FENCE;
+    buf[1] = buf[2] = buf[3] = 0;
+    memcpy(buf + 4, &flagsBE, 4);
+    buf[8] = length;
+    memcpy(buf + 9, payload, length);
+
+    return writeMessage(cl, buf, 9 + length);
+}
+
+static bool sendEndOfContinuousUpdates(rfbClientPtr cl)
+{
+    char type = MSG_END_OF_CONTINUOUS_UPDATES;
+    return writeMessage(cl, &type, 1);
+}
+
+// continuous updates are only offered once fences can throttle them
+static void announceContinuousUpdates(rfbClientPtr cl, clientState* state)
+{
+    if (state->fenceSupported && state->continuousSupported)
+    {
+        L("Client %s supports continuous updates\n", cl->host);
+        sendEndOfContinuousUpdates(cl);
+    }
+}
+
+static rfbBool enableEncoding(rfbClientPtr cl, void** data, int encoding)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL) { return FALSE; }
+
+    if (encoding == ENCODING_FENCE)
+    {
+        if (!state->fenceSupported)
+        {
+            // an empty request tells the client that we understand fences
+            char type = 0;
+            state->fenceSupported = true;
+            sendFence(cl, FENCE_REQUEST, sizeof(type), &type);
+            announceContinuousUpdates(cl, state);
+        }
+        return TRUE;
+    }
+
+    if (encoding == ENCODING_CONTINUOUS_UPDATES)
+    {
+        if (!state->continuousSupported)
+        {
+            state->continuousSupported = true;
+            announceContinuousUpdates(cl, state);
+        }
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void handleFenceResponse(rfbClientPtr cl, clientState* state, uint8_t length, const char* payload)
+{
+    uint32_t seq;
+    if (length != sizeof(seq))
+    {
+        // answer to the announcement
+        return;
+    }
+
+    memcpy(&seq, payload, sizeof(seq));
+    if (seq > state->fenceSent || seq <= state->fenceAcked)
+    {
+        return;
+    }
+
+    nsecs_t rtt = systemTime(SYSTEM_TIME_MONOTONIC) - state->fenceTime[seq % FENCE_HISTORY];
+    state->fenceRtt = (state->fenceRtt > 0) ? (state->fenceRtt * 3 + ns2ms(rtt)) / 4 : ns2ms(rtt);
+    state->fenceAcked = seq;
+}
+
+static bool handleFence(rfbClientPtr cl, clientState* state)
+{
+    char buf[8];
+    char payload[FENCE_MAX_PAYLOAD];
+    int n;
+
+    if ((n = rfbReadExact(cl, buf, sizeof(buf))) <= 0)
+    {
+        if (n != 0) { LE("Failed reading fence from %s\n", cl->host); }
+        rfbCloseClient(cl);
+        return true;
+    }
+
+    uint32_t flags;
+    memcpy(&flags, buf + 3, 4);
+    flags = Swap32IfLE(flags);
+    uint8_t length = buf[7];
+
+    if (length > FENCE_MAX_PAYLOAD)
+    {
+        LW("Client %s sent an oversized fence\n", cl->host);
+        rfbCloseClient(cl);
+        return true;
+    }
+
+    if (length > 0 && (n = rfbReadExact(cl, payload, length)) <= 0)
+    {
+        if (n != 0) { LE("Failed reading fence from %s\n", cl->host); }
+        rfbCloseClient(cl);
+        return true;
+    }
+
+    if (flags & FENCE_REQUEST)
+    {
+        // messages are handled strictly in order and the answer is written right away,
+        // which already satisfies both blocking flags; SyncNext is not supported
+        flags &= (FENCE_BLOCK_BEFORE | FENCE_BLOCK_AFTER);
+        sendFence(cl, flags, length, payload);
+    }
+    else
+    {
+        handleFenceResponse(cl, state, length, payload);
+    }
+
+    return true;
+}
+
+static bool handleEnableContinuousUpdates(rfbClientPtr cl, clientState* state)
+{
+    char buf[9];
+    int n;
+
+    if ((n = rfbReadExact(cl, buf, sizeof(buf))) <= 0)
+    {
+        if (n != 0) { LE("Failed reading continuous updates request from %s\n", cl->host); }
+        rfbCloseClient(cl);
+        return true;
+    }
+
+    uint16_t rect[4];
+    memcpy(rect, buf + 1, sizeof(rect));
+    int x = Swap16IfLE(rect[0]);
+    int y = Swap16IfLE(rect[1]);
+    int w = Swap16IfLE(rect[2]);
+    int h = Swap16IfLE(rect[3]);
+
+    sraRgnMakeEmpty(state->continuousRegion);
+    if (buf[0])
+    {
+        sraRegionPtr region = sraRgnCreateRect(x, y, x + w, y + h);
+        sraRgnOr(state->continuousRegion, region);
+        sraRgnDestroy(region);
+
+        L("Enabling continuous updates for %s (%dx%d+%d+%d)\n", cl->host, w, h, x, y);
+        state->continuousUpdates = true;
+        state->fenceAcked = state->fenceSent;
+        state->fenceBytes[state->fenceAcked % FENCE_HISTORY] = rfbStatGetSentBytes(cl);
+    }
+    else
+    {
+        L("Disabling continuous updates for %s\n", cl->host);
+        state->continuousUpdates = false;
+        sendEndOfContinuousUpdates(cl);
+    }
+
+    return true;
+}
+
+static rfbBool handleMessage(rfbClientPtr cl, void* data, const rfbClientToServerMsg* message)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL) { return FALSE; }
+
+    switch (message->type)
+    {
+        case MSG_FENCE:
+            return state->fenceSupported && handleFence(cl, state);
+        case MSG_ENABLE_CONTINUOUS_UPDATES:
+            return state->continuousSupported && handleEnableContinuousUpdates(cl, state);
+        default:
+            return FALSE;
+    }
+}
+
+void initContinuousUpdates(void)
+{
+    memset(&continuousExtension, 0, sizeof(continuousExtension));
+    continuousExtension.pseudoEncodings = continuousEncodings;
+    continuousExtension.enablePseudoEncoding = enableEncoding;
+    continuousExtension.handleMessage = handleMessage;
+
+    rfbRegisterProtocolExtension(&continuousExtension);
+}
+
+void continuousUpdateSent(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL || !state->continuousUpdates) { return; }
+
+    // the fence is written after the update returned to the event loop
+    state->fencePending = true;
+}
+
+static bool isCongested(rfbClientPtr cl, clientState* state)
+{
+    if (state->fenceSent - state->fenceAcked >= FENCE_HISTORY - 1)
+    {
+        return true;
+    }
+
+    // everything written before the last answered fence has been processed by the client
+    int inFlight = rfbStatGetSentBytes(cl) - state->fenceBytes[state->fenceAcked % FENCE_HISTORY];
+    double rtt = (state->fenceRtt > state->rtt) ? state->fenceRtt : state->rtt;
+    double window = 2 * state->throughput * rtt / 1000.0;
+    if (window < MIN_WINDOW) { window = MIN_WINDOW; }
+
+    return inFlight > window;
+}
+
+void updateContinuous(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL || !state->continuousUpdates) { return; }
+
+    if (state->fencePending)
+    {
+        // the client answers once it processed all updates before the fence
+        uint32_t seq = state->fenceSent + 1;
+        state->fenceTime[seq % FENCE_HISTORY] = systemTime(SYSTEM_TIME_MONOTONIC);
+        state->fenceBytes[seq % FENCE_HISTORY] = rfbStatGetSentBytes(cl);
+        state->fencePending = false;
+
+        if (!sendFence(cl, FENCE_BLOCK_BEFORE | FENCE_REQUEST, sizeof(seq), (const char*) &seq))
+        {
+            return;
+        }
+        state->fenceSent = seq;
+    }
+
+    // keep the region requested, as if the client asked again after every update
+    if (!isCongested(cl, state))
+    {
+        sraRgnOr(cl->requestedRegion, state->continuousRegion);
+    }
+}
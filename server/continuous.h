@@ -0,0 +1,46 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef CONTINUOUS_H
+#define CONTINUOUS_H
+
+extern "C" {
+    #include "rfb/rfb.h"
+}
+
+// pseudo-encodings and messages from the community RFB specification
+#define ENCODING_FENCE -312
+#define ENCODING_CONTINUOUS_UPDATES -313
+
+#define MSG_ENABLE_CONTINUOUS_UPDATES 150
+#define MSG_END_OF_CONTINUOUS_UPDATES 150
+#define MSG_FENCE 248
+
+#define FENCE_BLOCK_BEFORE (1u << 0)
+#define FENCE_BLOCK_AFTER  (1u << 1)
+#define FENCE_SYNC_NEXT    (1u << 2)
+#define FENCE_REQUEST      (1u << 31)
+
+#define FENCE_MAX_PAYLOAD 64
+
+void initContinuousUpdates(void);
+void continuousUpdateSent(rfbClientPtr cl);
+void updateContinuous(rfbClientPtr cl);
+
+#endif
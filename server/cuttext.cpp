@@ -0,0 +1,445 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <sys/socket.h>
+
+#include <zlib.h>
+
+#include "common.h"
+#include "client.h"
+#include "clipboard.h"
+#include "cuttext.h"
+
+// what clients may do before they sent their own capabilities
+#define DEFAULT_CAPS (CLIPBOARD_TEXT | CLIPBOARD_REQUEST | CLIPBOARD_PEEK | CLIPBOARD_NOTIFY | CLIPBOARD_PROVIDE)
+#define DEFAULT_TEXT_LIMIT (20 * 1024 * 1024)
+
+// compressed payloads may be slightly larger than their content
+#define MESSAGE_LIMIT (CUT_TEXT_LIMIT + CUT_TEXT_LIMIT / 1000 + 64)
+
+static int clipboardEncodings[] = { (int) ENCODING_EXTENDED_CLIPBOARD, 0 };
+static rfbProtocolExtension clipboardExtension;
+
+static void putU32(char* buf, uint32_t value)
+{
+    value = Swap32IfLE(value);
+    memcpy(buf, &value, 4);
+}
+
+static uint32_t getU32(const char* buf)
+{
+    uint32_t value;
+    memcpy(&value, buf, 4);
+    return Swap32IfLE(value);
+}
+
+// a negative length marks the extended format
+static bool writeCutText(rfbClientPtr cl, int32_t length, uint32_t flags, const char* data, int size)
+{
+    char header[sz_rfbServerCutTextMsg + 4];
+    header[0] = rfbServerCutText;
+    header[1] = header[2] = header[3] = 0;
+    putU32(header + 4, (uint32_t) length);
+    putU32(header + 8, flags);
+
+    // classic messages have no flags
+    int headerSize = (length < 0) ? sizeof(header) : sz_rfbServerCutTextMsg;
+
+    LOCK(cl->sendMutex);
+    int result = rfbWriteExact(cl, header, headerSize);
+    if (result > 0 && size > 0) { result = rfbWriteExact(cl, data, size); }
+    UNLOCK(cl->sendMutex);
+
+    if (result < 0)
+    {
+        LE("Failed writing to client %s\n", cl->host);
+        rfbCloseClient(cl);
+        return false;
+    }
+
+    return true;
+}
+
+static bool sendFlags(rfbClientPtr cl, uint32_t flags)
+{
+    return writeCutText(cl, -4, flags, NULL, 0);
+}
+
+static bool sendCaps(rfbClientPtr cl)
+{
+    char limit[4];
+    putU32(limit, CUT_TEXT_LIMIT);
+
+    uint32_t flags = CLIPBOARD_CAPS | CLIPBOARD_REQUEST | CLIPBOARD_PEEK | CLIPBOARD_NOTIFY | CLIPBOARD_PROVIDE | CLIPBOARD_TEXT;
+    return writeCutText(cl, -(4 + (int) sizeof(limit)), flags, limit, sizeof(limit));
+}
+
+// the text goes out with CRLF line endings and a terminating NUL,
+// text beyond the limit is left out rather than truncated
+static bool sendProvide(rfbClientPtr cl, uint32_t limit)
+{
+    int len = 0;
+    char* text = getClipboardText(&len, true);
+    if (text != NULL && len > (int) limit)
+    {
+        LW("Clipboard text for %s exceeds %u bytes\n", cl->host, limit);
+        free(text);
+        text = NULL;
+    }
+
+    int lines = 0;
+    for (int i = 0; text != NULL && i < len; i++) { if (text[i] == '\n') { lines++; } }
+
+    // U32 length, the text with at most one extra byte per line and the NUL
+    int plainSize = (text != NULL) ? 4 + len + lines + 1 : 0;
+    char* plain = (char*) malloc(plainSize + 1);
+    uLongf packedSize = compressBound(plainSize);
+    Bytef* packed = (Bytef*) malloc(packedSize);
+    if (plain == NULL || packed == NULL)
+    {
+        free(text);
+        free(plain);
+        free(packed);
+        return false;
+    }
+
+    uint32_t flags = CLIPBOARD_PROVIDE;
+    if (text != NULL)
+    {
+        char* out = plain + 4;
+        for (int i = 0; i < len; i++)
+        {
+            if (text[i] == '\n' && (i == 0 || text[i - 1] != '\r')) { *out++ = '\r'; }
+            *out++ = text[i];
+        }
+        *out++ = 0;
+
+        plainSize = out - plain;
+        putU32(plain, plainSize - 4);
+        flags |= CLIPBOARD_TEXT;
+    }
+
+    // text compresses well even at the fastest level
+    bool result = false;
+    if (compress2(packed, &packedSize, (const Bytef*) plain, plainSize, Z_BEST_SPEED) == Z_OK)
+    {
+        LD("Providing %d bytes of clipboard text to %s (%lu compressed)\n", (text != NULL) ? len : 0, cl->host, (unsigned long) packedSize);
+        result = writeCutText(cl, -(4 + (int) packedSize), flags, (const char*) packed, packedSize);
+    }
+
+    free(text);
+    free(plain);
+    free(packed);
+    return result;
+}
+
+static void handleCaps(rfbClientPtr cl, clientState* state, uint32_t flags, const char* data, int size)
+{
+    // one size for every format the client supports, in order
+    int offset = 0;
+    for (int format = 0; format < 16; format++)
+    {
+        if (!(flags & (1 << format))) { continue; }
+        if (offset + 4 > size) { break; }
+
+        if (format == 0) { state->clipboardTextLimit = getU32(data + offset); }
+        offset += 4;
+    }
+
+    state->clipboardCaps = flags & ~CLIPBOARD_CAPS;
+    L("Client %s accepts clipboard text up to %u bytes\n", cl->host, state->clipboardTextLimit);
+}
+
+// the client sends its text once we asked for it
+static void handleProvide(rfbClientPtr cl, uint32_t flags, const char* data, int size)
+{
+    if (!(flags & CLIPBOARD_TEXT) || cl->viewOnly) { return; }
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK) { return; }
+
+    // the text is the first format, only its length and content are inflated
+    char length[4];
+    stream.next_in = (Bytef*) data;
+    stream.avail_in = size;
+    stream.next_out = (Bytef*) length;
+    stream.avail_out = sizeof(length);
+
+    char* text = NULL;
+    uint32_t textLength = 0;
+    int result = inflate(&stream, Z_SYNC_FLUSH);
+    if (stream.avail_out == 0)
+    {
+        textLength = getU32(length);
+        if (textLength > CUT_TEXT_LIMIT)
+        {
+            LW("Client %s provided too much clipboard text (%u bytes)\n", cl->host, textLength);
+            textLength = 0;
+        }
+    }
+
+    if (textLength > 0 && (text = (char*) malloc(textLength)) != NULL)
+    {
+        stream.next_out = (Bytef*) text;
+        stream.avail_out = textLength;
+        while (stream.avail_out > 0 && (result == Z_OK || result == Z_BUF_ERROR) && stream.avail_in > 0)
+        {
+            result = inflate(&stream, Z_SYNC_FLUSH);
+        }
+    }
+    inflateEnd(&stream);
+
+    if (text == NULL) { return; }
+    if (stream.avail_out > 0)
+    {
+        LW("Client %s provided truncated clipboard text\n", cl->host);
+        free(text);
+        return;
+    }
+
+    // back to plain line feeds and without the NUL
+    uint32_t len = 0;
+    for (uint32_t i = 0; i < textLength && text[i] != 0; i++)
+    {
+        if (text[i] == '\r' && i + 1 < textLength && text[i + 1] == '\n') { continue; }
+        text[len++] = text[i];
+    }
+
+    LD("Updating local clipboard with %u bytes of remote text\n", len);
+    setClipboard(len, text);
+    free(text);
+}
+
+static void handleExtendedCutText(rfbClientPtr cl, clientState* state, const char* payload, int size)
+{
+    uint32_t flags = getU32(payload);
+    const char* data = payload + 4;
+    size -= 4;
+
+    if (flags & CLIPBOARD_CAPS)
+    {
+        handleCaps(cl, state, flags, data, size);
+    }
+    else if (flags & CLIPBOARD_REQUEST)
+    {
+        if (flags & CLIPBOARD_TEXT) { sendProvide(cl, state->clipboardTextLimit); }
+    }
+    else if (flags & CLIPBOARD_PEEK)
+    {
+        sendFlags(cl, CLIPBOARD_NOTIFY | CLIPBOARD_TEXT);
+    }
+    else if (flags & CLIPBOARD_NOTIFY)
+    {
+        // the text is only transferred when it actually changed on the client
+        if ((flags & CLIPBOARD_TEXT) && !cl->viewOnly) { sendFlags(cl, CLIPBOARD_REQUEST | CLIPBOARD_TEXT); }
+    }
+    else if (flags & CLIPBOARD_PROVIDE)
+    {
+        handleProvide(cl, flags, data, size);
+    }
+}
+
+// reads whatever the socket holds, false until all of it arrived
+static bool readPart(rfbClientPtr cl, char* buffer, int size, int* done)
+{
+    while (*done < size)
+    {
+        ssize_t n = recv(cl->sock, buffer + *done, size - *done, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) { return false; }
+        if (n <= 0)
+        {
+            if (n < 0) { LE("Failed reading clipboard from %s (errno %d)\n", cl->host, errno); }
+            rfbCloseClient(cl);
+            return false;
+        }
+
+        *done += n;
+    }
+
+    return true;
+}
+
+static bool startCutText(rfbClientPtr cl, clientState* state)
+{
+    int32_t length = (int32_t) getU32(state->cutTextHeader + 4);
+    state->cutTextExtended = (length < 0);
+    if (length < 0)
+    {
+        if (-(int64_t) length < 4 || -(int64_t) length > MESSAGE_LIMIT)
+        {
+            LW("Client %s sent an invalid clipboard message (%d bytes)\n", cl->host, length);
+            rfbCloseClient(cl);
+            return false;
+        }
+
+        length = -length;
+    }
+    else if (length > CUT_TEXT_LIMIT)
+    {
+        // classic Latin-1 text
+        LW("Client %s sent too much clipboard text (%d bytes)\n", cl->host, length);
+        rfbCloseClient(cl);
+        return false;
+    }
+
+    state->cutText = (char*) malloc(length + 1);
+    if (state->cutText == NULL)
+    {
+        rfbCloseClient(cl);
+        return false;
+    }
+
+    state->cutTextSize = length;
+    state->cutTextRead = 0;
+    return true;
+}
+
+// large texts arrive over many loop iterations, the other clients are served meanwhile;
+// returns whether a whole message was handled
+static bool readCutText(rfbClientPtr cl, clientState* state)
+{
+    if (state->cutText == NULL)
+    {
+        if (!readPart(cl, state->cutTextHeader, sizeof(state->cutTextHeader), &state->cutTextHeaderRead)) { return false; }
+        if (!startCutText(cl, state)) { return false; }
+    }
+
+    if (!readPart(cl, state->cutText, state->cutTextSize, &state->cutTextRead)) { return false; }
+
+    char* text = state->cutText;
+    int size = state->cutTextSize;
+    state->cutText = NULL;
+    state->cutTextHeaderRead = 0;
+
+    if (state->cutTextExtended)
+    {
+        handleExtendedCutText(cl, state, text, size);
+    }
+    else if (!cl->viewOnly)
+    {
+        LD("Updating local clipboard with remote text\n");
+        setClipboardLatin1(size, text);
+    }
+
+    free(text);
+    return true;
+}
+
+static rfbBool enableEncoding(rfbClientPtr cl, void** data, int encoding)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL || encoding != (int) ENCODING_EXTENDED_CLIPBOARD) { return FALSE; }
+
+    // messages are taken off the socket before libvncserver sees them,
+    // which is not possible for encrypted or websocket connections
+    if (cl->sslctx != NULL || cl->wsctx != NULL) { return TRUE; }
+
+    if (!state->extendedClipboard)
+    {
+        state->clipboardCaps = DEFAULT_CAPS;
+        state->clipboardTextLimit = DEFAULT_TEXT_LIMIT;
+        if (!sendCaps(cl)) { return TRUE; }
+
+        L("Client %s supports the extended clipboard\n", cl->host);
+        state->extendedClipboard = true;
+
+        // libvncserver must not read from the socket anymore, the event loop still watches it
+        FD_CLR(cl->sock, &cl->screen->allFds);
+    }
+
+    return TRUE;
+}
+
+void initExtendedClipboard(void)
+{
+    memset(&clipboardExtension, 0, sizeof(clipboardExtension));
+    clipboardExtension.pseudoEncodings = clipboardEncodings;
+    clipboardExtension.enablePseudoEncoding = enableEncoding;
+
+    rfbRegisterProtocolExtension(&clipboardExtension);
+}
+
+// libvncserver rejects cut text with a negative length, so the sockets of extended
+// clients are no longer selected by it; all their messages are dispatched here
+void processCutText(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL || !state->extendedClipboard) { return; }
+
+    while (cl->sock >= 0)
+    {
+        // the rest of a message which did not arrive at once
+        if (state->cutTextHeaderRead > 0)
+        {
+            if (!readCutText(cl, state)) { break; }
+            continue;
+        }
+
+        char type;
+        ssize_t n = recv(cl->sock, &type, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) { break; }
+        if (n <= 0)
+        {
+            // nobody else notices the viewer going away
+            if (n < 0) { LE("Failed reading from client %s (errno %d)\n", cl->host, errno); }
+            rfbCloseClient(cl);
+            break;
+        }
+
+        if (type == rfbClientCutText)
+        {
+            if (!readCutText(cl, state)) { break; }
+        }
+        else
+        {
+            rfbProcessClientMessage(cl);
+        }
+    }
+}
+
+void sendClipboardChange(rfbScreenInfoPtr screen)
+{
+    char* latin1 = NULL;
+    int len = 0;
+
+    for (rfbClientPtr cl = screen->clientHead; cl; cl = cl->next)
+    {
+        clientState* state = getClientState(cl);
+        if (state == NULL || cl->sock < 0) { continue; }
+
+        if (!state->extendedClipboard)
+        {
+            if (latin1 == NULL) { latin1 = getClipboardText(&len, false); }
+            if (latin1 != NULL) { writeCutText(cl, len, 0, latin1, len); }
+        }
+        else if (state->clipboardCaps & CLIPBOARD_NOTIFY)
+        {
+            // fetched only when the client actually pastes
+            sendFlags(cl, CLIPBOARD_NOTIFY | CLIPBOARD_TEXT);
+        }
+        else if (state->clipboardCaps & CLIPBOARD_PROVIDE)
+        {
+            sendProvide(cl, state->clipboardTextLimit);
+        }
+    }
+
+    free(latin1);
+}
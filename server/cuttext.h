@@ -0,0 +1,47 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef CUTTEXT_H
+#define CUTTEXT_H
+
+extern "C" {
+    #include "rfb/rfb.h"
+}
+
+// extended clipboard, cut text messages with a negative length carrying
+// U32 flags followed by the zlib compressed formats or the capabilities
+#define ENCODING_EXTENDED_CLIPBOARD 0xC0A1E5CE
+
+#define CLIPBOARD_TEXT    (1 << 0)
+#define CLIPBOARD_FORMATS 0xFFFF
+
+#define CLIPBOARD_CAPS    (1 << 24)
+#define CLIPBOARD_REQUEST (1 << 25)
+#define CLIPBOARD_PEEK    (1 << 26)
+#define CLIPBOARD_NOTIFY  (1 << 27)
+#define CLIPBOARD_PROVIDE (1 << 28)
+
+// largest text accepted or sent in either direction (bytes)
+#define CUT_TEXT_LIMIT (20 * 1024 * 1024)
+
+void initExtendedClipboard(void);
+void processCutText(rfbClientPtr cl);
+void sendClipboardChange(rfbScreenInfoPtr screen);
+
+#endif
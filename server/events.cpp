@@ -0,0 +1,201 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "common.h"
+#include "events.h"
+
+#define MAX_EVENTS 32
+
+// descriptors of other modules which may wake up the loop
+#define MAX_SOURCES 8
+
+struct eventSource
+{
+    int fd;
+    int event;
+};
+
+static int epollFd = -1;
+static int timerFd = -1;
+static int wakeupFd = -1;
+static eventSource sources[MAX_SOURCES];
+static int sourceCount = 0;
+
+static bool timerArmed = false;
+
+static int addFd(int fd)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0 && errno != EEXIST)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+int initEvents(int fd)
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0)
+    {
+        LE("Failed creating epoll instance (errno %d)\n", errno);
+        return -1;
+    }
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerFd < 0 || addFd(timerFd) != 0)
+    {
+        LE("Failed creating frame timer (errno %d)\n", errno);
+        return -1;
+    }
+
+    wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeupFd < 0 || addFd(wakeupFd) != 0)
+    {
+        LE("Failed creating wakeup event (errno %d)\n", errno);
+        return -1;
+    }
+
+    return watchEvents(fd, EVENT_CAPTURE);
+}
+
+// the owner of the descriptor has to consume whatever made it readable
+int watchEvents(int fd, int event)
+{
+    if (sourceCount == MAX_SOURCES || addFd(fd) != 0)
+    {
+        LE("Failed watching event source %d (errno %d)\n", fd, errno);
+        return -1;
+    }
+
+    sources[sourceCount].fd = fd;
+    sources[sourceCount].event = event;
+    sourceCount++;
+    return 0;
+}
+
+static int findSource(int fd)
+{
+    for (int i = 0; i < sourceCount; i++)
+    {
+        if (sources[i].fd == fd) { return sources[i].event; }
+    }
+
+    return EVENT_SOCKET;
+}
+
+int waitEvents(void)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+    if (count < 0)
+    {
+        if (errno != EINTR) { LE("Failed waiting for events (errno %d)\n", errno); }
+        return 0;
+    }
+
+    int result = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int fd = events[i].data.fd;
+        if (fd == timerFd)
+        {
+            uint64_t expirations;
+            read(timerFd, &expirations, sizeof(expirations));
+            timerArmed = false;
+            result |= EVENT_TIMER;
+        }
+        else if (fd == wakeupFd)
+        {
+            uint64_t wakeups;
+            read(wakeupFd, &wakeups, sizeof(wakeups));
+            result |= EVENT_WAKEUP;
+        }
+        else
+        {
+            result |= findSource(fd);
+        }
+    }
+
+    return result;
+}
+
+// sockets of libvncserver are watched from the moment they exist,
+// readable ones are reported as EVENT_SOCKET
+void watchSocket(int fd)
+{
+    if (fd >= 0 && addFd(fd) != 0) { LE("Failed watching socket %d (errno %d)\n", fd, errno); }
+}
+
+// closed sockets leave the epoll set on their own, the number might belong to a new one already
+void unwatchSocket(int fd)
+{
+    if (fd >= 0) { epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL); }
+}
+
+// a negative delay disarms the timer, the loop then sleeps until a socket
+// or the capture thread wakes it up
+void armTimer(nsecs_t delay)
+{
+    if (delay < 0 && !timerArmed) { return; }
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (delay >= 0)
+    {
+        // a zero value would disarm the timer instead of firing immediately
+        if (delay == 0) { delay = 1; }
+        spec.it_value.tv_sec = delay / 1000000000;
+        spec.it_value.tv_nsec = delay % 1000000000;
+    }
+
+    if (timerfd_settime(timerFd, 0, &spec, NULL) != 0)
+    {
+        LE("Failed arming frame timer (errno %d)\n", errno);
+        return;
+    }
+
+    timerArmed = (delay >= 0);
+}
+
+// cancels the current sleep, safe to call from any thread
+void wakeEvents(void)
+{
+    if (wakeupFd < 0) { return; }
+
+    uint64_t wakeup = 1;
+    write(wakeupFd, &wakeup, sizeof(wakeup));
+}
+
+void closeEvents(void)
+{
+    if (wakeupFd >= 0) { close(wakeupFd); wakeupFd = -1; }
+    if (timerFd >= 0) { close(timerFd); timerFd = -1; }
+    if (epollFd >= 0) { close(epollFd); epollFd = -1; }
+    sourceCount = 0;
+}
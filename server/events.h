@@ -0,0 +1,46 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <utils/Timers.h>
+
+extern "C" {
+    #include "rfb/rfb.h"
+}
+
+// sources which woke up the main loop
+#define EVENT_SOCKET    (1 << 0)
+#define EVENT_CAPTURE   (1 << 1)
+#define EVENT_TIMER     (1 << 2)
+#define EVENT_WAKEUP    (1 << 3)
+#define EVENT_CLIPBOARD (1 << 4)
+#define EVENT_METRICS   (1 << 5)
+
+int initEvents(int captureFd);
+int watchEvents(int fd, int event);
+int waitEvents(void);
+void watchSocket(int fd);
+void unwatchSocket(int fd);
+void armTimer(nsecs_t delay);
+void wakeEvents(void);
+void closeEvents(void);
+
+#endif
@@ -0,0 +1,191 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common.h"
+#include "client.h"
+#include "latency.h"
+#include "metrics.h"
+
+// distance from the pointer in which its effect is expected (pixels)
+#define INPUT_RADIUS 128
+
+// input without a visible effect until then is not measured (ms)
+#define INPUT_TIMEOUT 1000
+
+// interval of the per-client summaries in the log (s)
+#define LATENCY_REPORT 60
+
+// upper bounds of the per-client buckets (ms)
+static const int bounds[LATENCY_BUCKETS] = { 5, 10, 16, 25, 33, 50, 75, 100, 150, 250, 500, 1000 };
+
+static void addSample(latencyHistogram* h, nsecs_t latency)
+{
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS && latency > ms2ns(bounds[bucket])) { bucket++; }
+
+    h->buckets[bucket]++;
+    h->count++;
+    h->sum += latency;
+    if (latency > h->max) { h->max = latency; }
+}
+
+// upper bound of the bucket holding the given share of the samples, -1 beyond the last one
+static int getPercentile(const latencyHistogram* h, double share)
+{
+    uint32_t rank = (uint32_t) (h->count * share + 0.5);
+    if (rank == 0) { rank = 1; }
+
+    uint32_t total = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        total += h->buckets[i];
+        if (total >= rank) { return bounds[i]; }
+    }
+
+    return -1;
+}
+
+static void formatHistogram(char* text, size_t size, const latencyHistogram* h)
+{
+    if (h->count == 0)
+    {
+        snprintf(text, size, "no samples");
+        return;
+    }
+
+    int p50 = getPercentile(h, 0.5);
+    int p90 = getPercentile(h, 0.9);
+    int p99 = getPercentile(h, 0.99);
+    snprintf(text, size, "n=%u avg %.1f ms, p50 %s%d, p90 %s%d, p99 %s%d, max %.1f ms", h->count,
+        h->sum / 1e6 / h->count, (p50 < 0) ? ">" : "<=", (p50 < 0) ? bounds[LATENCY_BUCKETS - 1] : p50,
+        (p90 < 0) ? ">" : "<=", (p90 < 0) ? bounds[LATENCY_BUCKETS - 1] : p90,
+        (p99 < 0) ? ">" : "<=", (p99 < 0) ? bounds[LATENCY_BUCKETS - 1] : p99, h->max / 1e6);
+}
+
+static void logLatency(rfbClientPtr cl, int level)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL || (state->inputLatency.count == 0 && state->sendLatency.count == 0)) { return; }
+
+    char input[160];
+    char send[160];
+    formatHistogram(input, sizeof(input), &state->inputLatency);
+    formatHistogram(send, sizeof(send), &state->sendLatency);
+
+    LOG_AT(level, "Latency of %s: input to capture %s (%u without visible effect); capture to send %s\n",
+        cl->host, input, state->unansweredInputs, send);
+}
+
+// the oldest unanswered input is kept, later ones in the meantime are part of the same interaction;
+// unchanged frames never reach latencyFrameCaptured, so an expired input is replaced here
+void markInput(rfbClientPtr cl, int x, int y)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL) { return; }
+
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (state->inputTime != 0)
+    {
+        if (now - state->inputTime <= ms2ns(INPUT_TIMEOUT)) { return; }
+        state->unansweredInputs++;
+    }
+
+    state->inputTime = now;
+    state->inputX = x;
+    state->inputY = y;
+}
+
+static bool isAffected(clientState* state, sraRegionPtr dirty)
+{
+    if (state->inputX < 0) { return true; }
+
+    sraRegionPtr around = sraRgnCreateRect(state->inputX - INPUT_RADIUS, state->inputY - INPUT_RADIUS,
+        state->inputX + INPUT_RADIUS, state->inputY + INPUT_RADIUS);
+    bool affected = sraRgnAnd(around, dirty);
+    sraRgnDestroy(around);
+
+    return affected;
+}
+
+// called with the changes of every new frame and the time its capture started
+void latencyFrameCaptured(rfbScreenInfoPtr screen, sraRegionPtr dirty, nsecs_t captured)
+{
+    for (rfbClientPtr cl = screen->clientHead; cl; cl = cl->next)
+    {
+        clientState* state = getClientState(cl);
+        if (state == NULL) { continue; }
+
+        if (state->pendingCapture == 0) { state->pendingCapture = captured; }
+
+        // frames requested before the input arrived cannot show its effect
+        if (state->inputTime == 0 || captured < state->inputTime) { continue; }
+
+        // a change after the timeout is no longer attributed to the input
+        nsecs_t latency = captured - state->inputTime;
+        if (latency > ms2ns(INPUT_TIMEOUT))
+        {
+            state->unansweredInputs++;
+            state->inputTime = 0;
+        }
+        else if (isAffected(state, dirty))
+        {
+            addSample(&state->inputLatency, latency);
+            observeDuration(METRIC_INPUT_LATENCY, latency);
+            state->inputTime = 0;
+        }
+    }
+}
+
+// the pending changes are now part of the region libvncserver sends next
+void latencyRegionFlushed(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL || state->pendingCapture == 0) { return; }
+
+    if (state->flushedCapture == 0) { state->flushedCapture = state->pendingCapture; }
+    state->pendingCapture = 0;
+}
+
+void latencyUpdateSent(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL) { return; }
+
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (state->flushedCapture != 0)
+    {
+        nsecs_t latency = now - state->flushedCapture;
+        addSample(&state->sendLatency, latency);
+        observeDuration(METRIC_SEND_LATENCY, latency);
+        state->flushedCapture = 0;
+    }
+
+    if (state->latencyReported == 0) { state->latencyReported = now; }
+    if (now - state->latencyReported >= s2ns(LATENCY_REPORT))
+    {
+        logLatency(cl, LOG_DEBUG);
+        state->latencyReported = now;
+    }
+}
+
+// the summary of a session is logged when the client disconnects
+void reportLatency(rfbClientPtr cl)
+{
+    logLatency(cl, LOG_INFO);
+}
@@ -0,0 +1,39 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <utils/Timers.h>
+
+extern "C" {
+    #include "rfb/rfb.h"
+    #include "rfb/rfbregion.h"
+}
+
+// input is timestamped when it arrives, the first captured frame which changed
+// around it ends the input to capture latency; the capture time of a frame is
+// carried along until its changes went out to a client (capture to send)
+void markInput(rfbClientPtr cl, int x, int y);
+void latencyFrameCaptured(rfbScreenInfoPtr screen, sraRegionPtr dirty, nsecs_t captured);
+void latencyRegionFlushed(rfbClientPtr cl);
+void latencyUpdateSent(rfbClientPtr cl);
+void reportLatency(rfbClientPtr cl);
+
+#endif
@@ -0,0 +1,417 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdarg.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <atomic>
+
+#include "common.h"
+#include "client.h"
+#include "metrics.h"
+#include "snapshot.h"
+
+// most buckets of a histogram, +Inf is implicit
+#define MAX_BUCKETS 12
+
+// sums are kept as integers in millionths of the unit
+#define SUM_SCALE 1e6
+
+// how long a scraper may take to send its request (ms), checked whenever the endpoint wakes up
+#define REQUEST_WAIT 5000
+
+// how long a response may wait for a stalled scraper (ms)
+#define SEND_WAIT 100
+
+// connections waiting for their request, the oldest one gives way
+#define MAX_PENDING 8
+
+#define MAX_REQUEST 1024
+
+struct metricDescription
+{
+    const char* name;
+    const char* help;
+};
+
+struct histogram
+{
+    const char* name;
+    const char* help;
+    double bounds[MAX_BUCKETS];
+    std::atomic<uint64_t> buckets[MAX_BUCKETS + 1];
+    std::atomic<uint64_t> sum;
+};
+
+static const metricDescription counters[METRIC_COUNTERS] = {
+    { "vncd_frames_captured_total", "Frames read from the compositor" },
+    { "vncd_frames_changed_total", "Captured frames which differed from the previous one" },
+    { "vncd_updates_sent_total", "Framebuffer updates sent to all clients" },
+    { "vncd_input_events_total", "Input events written to the virtual device" },
+};
+
+static std::atomic<uint64_t> counterValues[METRIC_COUNTERS];
+
+// unused bounds stay zero and end the list
+static histogram histograms[METRIC_HISTOGRAMS] = {
+    { "vncd_capture_latency_seconds", "Time from requesting a capture until the frame reached the event loop",
+        { 0.002, 0.005, 0.01, 0.016, 0.025, 0.033, 0.05, 0.1, 0.25, 0.5 }, {}, {} },
+    { "vncd_capture_seconds", "Time spent composing and copying a frame",
+        { 0.001, 0.002, 0.005, 0.01, 0.016, 0.025, 0.05, 0.1, 0.25 }, {}, {} },
+    { "vncd_change_detection_seconds", "Time spent finding the changed tiles of a frame",
+        { 0.0005, 0.001, 0.002, 0.005, 0.01, 0.02, 0.05 }, {}, {} },
+    { "vncd_dirty_ratio", "Share of the screen which changed in a frame",
+        { 0.001, 0.01, 0.05, 0.1, 0.25, 0.5, 0.75, 1 }, {}, {} },
+    { "vncd_input_to_capture_seconds", "Time from receiving input until a frame changed around it was captured",
+        { 0.01, 0.016, 0.025, 0.033, 0.05, 0.075, 0.1, 0.15, 0.25, 0.5, 1 }, {}, {} },
+    { "vncd_capture_to_send_seconds", "Time from capturing a change until it was sent to a client",
+        { 0.002, 0.005, 0.01, 0.016, 0.025, 0.033, 0.05, 0.1, 0.25, 0.5, 1 }, {}, {} },
+};
+
+struct pendingRequest
+{
+    int fd;
+    nsecs_t accepted;
+};
+
+static int listenFd = -1;
+
+// the listening socket and the pending connections, readable as a whole for the main loop
+static int pollFd = -1;
+static pendingRequest pending[MAX_PENDING];
+static int pendingCount = 0;
+
+void countMetric(metricCounter counter, uint64_t amount)
+{
+    counterValues[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+void observeMetric(metricHistogram index, double value)
+{
+    histogram* h = &histograms[index];
+
+    int bucket = 0;
+    while (bucket < MAX_BUCKETS && h->bounds[bucket] > 0 && value > h->bounds[bucket]) { bucket++; }
+    if (bucket < MAX_BUCKETS && h->bounds[bucket] == 0) { bucket = MAX_BUCKETS; }
+
+    // only the bucket the value falls into is counted, the output accumulates them
+    h->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    h->sum.fetch_add((uint64_t) (value * SUM_SCALE), std::memory_order_relaxed);
+}
+
+void observeDuration(metricHistogram index, nsecs_t duration)
+{
+    observeMetric(index, duration / 1e9);
+}
+
+int initMetrics(int port)
+{
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0)
+    {
+        LE("Failed creating metrics socket (errno %d)\n", errno);
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    // only reachable from the device itself, e.g. through adb forward
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(listenFd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(listenFd, 4) != 0)
+    {
+        LE("Failed listening for metrics on port %d (errno %d)\n", port, errno);
+        close(listenFd);
+        listenFd = -1;
+        return -1;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = listenFd;
+
+    pollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (pollFd < 0 || epoll_ctl(pollFd, EPOLL_CTL_ADD, listenFd, &ev) != 0)
+    {
+        LE("Failed watching metrics socket (errno %d)\n", errno);
+        closeMetrics();
+        return -1;
+    }
+
+    L("Serving metrics on 127.0.0.1:%d\n", port);
+    return pollFd;
+}
+
+typedef struct _textBuffer
+{
+    char* data;
+    size_t length;
+    size_t capacity;
+} textBuffer;
+
+static void appendText(textBuffer* text, const char* format, ...)
+{
+    while (true)
+    {
+        va_list args;
+        va_start(args, format);
+        size_t available = text->capacity - text->length;
+        int written = vsnprintf(text->data + text->length, available, format, args);
+        va_end(args);
+
+        if (written < 0) { return; }
+        if ((size_t) written < available)
+        {
+            text->length += written;
+            return;
+        }
+
+        size_t capacity = text->capacity * 2 + written;
+        char* data = (char*) realloc(text->data, capacity);
+        if (data == NULL) { return; }
+
+        text->data = data;
+        text->capacity = capacity;
+    }
+}
+
+static void formatHistogram(textBuffer* text, histogram* h)
+{
+    appendText(text, "# HELP %s %s\n# TYPE %s histogram\n", h->name, h->help, h->name);
+
+    uint64_t total = 0;
+    for (int i = 0; i < MAX_BUCKETS && h->bounds[i] > 0; i++)
+    {
+        total += h->buckets[i].load(std::memory_order_relaxed);
+        appendText(text, "%s_bucket{le=\"%g\"} %llu\n", h->name, h->bounds[i], (unsigned long long) total);
+    }
+
+    total += h->buckets[MAX_BUCKETS].load(std::memory_order_relaxed);
+    appendText(text, "%s_bucket{le=\"+Inf\"} %llu\n", h->name, (unsigned long long) total);
+    appendText(text, "%s_sum %.6f\n", h->name, h->sum.load(std::memory_order_relaxed) / SUM_SCALE);
+    appendText(text, "%s_count %llu\n", h->name, (unsigned long long) total);
+}
+
+enum clientFamilyIndex
+{
+    CLIENT_BACKLOG,
+    CLIENT_RTT,
+    CLIENT_THROUGHPUT,
+    CLIENT_SKIPPED,
+    CLIENT_ENCODING,
+    CLIENT_ENCODING_RAW,
+    CLIENT_FAMILIES
+};
+
+struct clientFamily
+{
+    const char* name;
+    const char* help;
+    const char* type;
+};
+
+static const clientFamily clientFamilies[CLIENT_FAMILIES] = {
+    { "vncd_client_backlog_bytes", "Data queued in the socket of a client", "gauge" },
+    { "vncd_client_rtt_seconds", "Estimated round trip time of a client", "gauge" },
+    { "vncd_client_throughput_bytes", "Estimated bytes per second a client receives", "gauge" },
+    { "vncd_client_skipped_frames_total", "Frames merged into later updates of a client", "counter" },
+    { "vncd_encoding_bytes_total", "Bytes sent per encoding to a client", "counter" },
+    { "vncd_encoding_raw_bytes_total", "Bytes the same rectangles take in raw encoding", "counter" },
+};
+
+static void formatEncodings(textBuffer* text, rfbClientPtr cl, uint32_t id, const char* family, bool raw)
+{
+    // libvncserver counts every encoding used, including pseudo-encodings
+    for (rfbStatList* stat = cl->statEncList; stat != NULL; stat = stat->Next)
+    {
+        if (stat->sentCount == 0) { continue; }
+
+        char name[64];
+        encodingName(stat->type, name, sizeof(name));
+        appendText(text, "%s{client=\"%s\",id=\"%u\",encoding=\"%s\"} %u\n", family, cl->host, id, name,
+            raw ? stat->bytesSentIfRaw : stat->bytesSent);
+    }
+}
+
+static void formatClients(textBuffer* text, rfbScreenInfoPtr screen)
+{
+    int count = 0;
+    for (rfbClientPtr cl = screen->clientHead; cl; cl = cl->next) { count++; }
+    appendText(text, "# HELP vncd_clients Connected clients\n# TYPE vncd_clients gauge\nvncd_clients %d\n", count);
+
+    // all samples of a family have to follow its header
+    for (int family = 0; family < CLIENT_FAMILIES; family++)
+    {
+        const clientFamily* f = &clientFamilies[family];
+        appendText(text, "# HELP %s %s\n# TYPE %s %s\n", f->name, f->help, f->name, f->type);
+
+        for (rfbClientPtr cl = screen->clientHead; cl; cl = cl->next)
+        {
+            clientState* state = getClientState(cl);
+            if (state == NULL) { continue; }
+
+            switch (family)
+            {
+                case CLIENT_BACKLOG: appendText(text, "%s{client=\"%s\",id=\"%u\"} %d\n", f->name, cl->host, state->id, state->backlog); break;
+                case CLIENT_RTT: appendText(text, "%s{client=\"%s\",id=\"%u\"} %.4f\n", f->name, cl->host, state->id, state->rtt / 1000.0); break;
+                case CLIENT_THROUGHPUT: appendText(text, "%s{client=\"%s\",id=\"%u\"} %.0f\n", f->name, cl->host, state->id, state->throughput); break;
+                case CLIENT_SKIPPED: appendText(text, "%s{client=\"%s\",id=\"%u\"} %u\n", f->name, cl->host, state->id, state->skippedFrames); break;
+                default: formatEncodings(text, cl, state->id, f->name, family == CLIENT_ENCODING_RAW); break;
+            }
+        }
+    }
+}
+
+static void formatMetrics(textBuffer* text, rfbScreenInfoPtr screen)
+{
+    for (int i = 0; i < METRIC_COUNTERS; i++)
+    {
+        appendText(text, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counters[i].name, counters[i].help,
+            counters[i].name, counters[i].name, (unsigned long long) counterValues[i].load(std::memory_order_relaxed));
+    }
+
+    for (int i = 0; i < METRIC_HISTOGRAMS; i++) { formatHistogram(text, &histograms[i]); }
+    formatClients(text, screen);
+}
+
+static void sendAll(int fd, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) { continue; }
+        if (written <= 0) { return; }
+
+        data += written;
+        size -= written;
+    }
+}
+
+// returns whether the connection is kept open for a later answer
+static bool answerRequest(int fd, rfbScreenInfoPtr screen)
+{
+    // scrapers send a single small request right after connecting
+    char request[MAX_REQUEST + 1];
+    ssize_t len = recv(fd, request, MAX_REQUEST, 0);
+    if (len <= 0) { return false; }
+    request[len] = 0;
+
+    // images are answered once they are encoded
+    if (strncmp(request, "GET /snapshot", 13) == 0 && (request[13] == ' ' || request[13] == '?'))
+    {
+        return requestSnapshot(fd, request + 13);
+    }
+
+    textBuffer body = { NULL, 0, 0 };
+    const char* status = "404 Not Found";
+    if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET / ", 6) == 0)
+    {
+        status = "200 OK";
+        formatMetrics(&body, screen);
+    }
+
+    textBuffer header = { NULL, 0, 0 };
+    appendText(&header, "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        status, body.length);
+
+    sendAll(fd, header.data, header.length);
+    sendAll(fd, body.data, body.length);
+    free(header.data);
+    free(body.data);
+    return false;
+}
+
+static void dropPending(int index, bool closeFd)
+{
+    epoll_ctl(pollFd, EPOLL_CTL_DEL, pending[index].fd, NULL);
+    if (closeFd) { close(pending[index].fd); }
+
+    pendingCount--;
+    memmove(&pending[index], &pending[index + 1], (pendingCount - index) * sizeof(pendingRequest));
+}
+
+static void acceptRequests(void)
+{
+    int fd;
+    while ((fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        if (pendingCount == MAX_PENDING) { dropPending(0, true); }
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+
+        if (epoll_ctl(pollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+            close(fd);
+            continue;
+        }
+
+        pending[pendingCount].fd = fd;
+        pending[pendingCount].accepted = systemTime(SYSTEM_TIME_MONOTONIC);
+        pendingCount++;
+    }
+}
+
+static void readRequest(int fd, rfbScreenInfoPtr screen)
+{
+    int index = 0;
+    while (index < pendingCount && pending[index].fd != fd) { index++; }
+    if (index == pendingCount) { return; }
+    dropPending(index, false);
+
+    // the response is small enough for the socket buffer, a stalled scraper only costs the timeout
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    struct timeval timeout = { 0, SEND_WAIT * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if (!answerRequest(fd, screen)) { close(fd); }
+}
+
+// never blocks, connections are only read once their request arrived
+void serveMetrics(rfbScreenInfoPtr screen)
+{
+    struct epoll_event events[MAX_PENDING + 1];
+    int count = epoll_wait(pollFd, events, MAX_PENDING + 1, 0);
+    for (int i = 0; i < count; i++)
+    {
+        if (events[i].data.fd == listenFd) { acceptRequests(); }
+        else { readRequest(events[i].data.fd, screen); }
+    }
+
+    nsecs_t expired = systemTime(SYSTEM_TIME_MONOTONIC) - ms2ns(REQUEST_WAIT);
+    while (pendingCount > 0 && pending[0].accepted < expired) { dropPending(0, true); }
+}
+
+void closeMetrics(void)
+{
+    while (pendingCount > 0) { dropPending(0, true); }
+    if (pollFd >= 0) { close(pollFd); pollFd = -1; }
+    if (listenFd >= 0) { close(listenFd); listenFd = -1; }
+}
@@ -0,0 +1,60 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#include <utils/Timers.h>
+
+extern "C" {
+    #include "rfb/rfb.h"
+}
+
+// counters and histograms are updated lock-free from any thread,
+// the endpoint formats them for Prometheus on request
+enum metricCounter
+{
+    METRIC_FRAMES_CAPTURED,
+    METRIC_FRAMES_CHANGED,
+    METRIC_UPDATES_SENT,
+    METRIC_INPUT_EVENTS,
+    METRIC_COUNTERS
+};
+
+enum metricHistogram
+{
+    METRIC_CAPTURE_LATENCY, // capture request until the frame is in the event loop
+    METRIC_CAPTURE_TIME,    // composition and copy of a frame
+    METRIC_COMPARE_TIME,    // change detection
+    METRIC_DIRTY_RATIO,     // share of the screen changed per frame
+    METRIC_INPUT_LATENCY,   // input until a frame showing its effect was captured
+    METRIC_SEND_LATENCY,    // capture until the changes were sent to a client
+    METRIC_HISTOGRAMS
+};
+
+int initMetrics(int port);
+void countMetric(metricCounter counter, uint64_t amount = 1);
+void observeMetric(metricHistogram histogram, double value);
+void observeDuration(metricHistogram histogram, nsecs_t duration);
+void serveMetrics(rfbScreenInfoPtr screen);
+void closeMetrics(void);
+
+#endif
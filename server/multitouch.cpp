@@ -0,0 +1,128 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "common.h"
+#include "client.h"
+#include "input.h"
+#include "multitouch.h"
+
+extern "C" {
+    #include "libvncserver/scale.h"
+}
+
+// size of a single contact in the message
+#define CONTACT_SIZE 8
+
+static int multitouchEncodings[] = { ENCODING_MULTITOUCH, 0 };
+static rfbProtocolExtension multitouchExtension;
+
+static rfbBool enableEncoding(rfbClientPtr cl, void** data, int encoding)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL || encoding != ENCODING_MULTITOUCH) { return FALSE; }
+
+    if (!state->multitouchSupported)
+    {
+        char buf[4] = { (char) MSG_MULTITOUCH, SUINPUT_MAX_CONTACTS, 0, 0 };
+
+        LOCK(cl->sendMutex);
+        int result = rfbWriteExact(cl, buf, sizeof(buf));
+        UNLOCK(cl->sendMutex);
+
+        if (result < 0)
+        {
+            LE("Failed writing to client %s\n", cl->host);
+            rfbCloseClient(cl);
+            return TRUE;
+        }
+
+        L("Client %s supports multi-touch\n", cl->host);
+        state->multitouchSupported = true;
+    }
+
+    return TRUE;
+}
+
+static bool handleMultitouch(rfbClientPtr cl)
+{
+    char header[3];
+    char contacts[SUINPUT_MAX_CONTACTS * CONTACT_SIZE];
+    int n;
+
+    if ((n = rfbReadExact(cl, header, sizeof(header))) <= 0)
+    {
+        if (n != 0) { LE("Failed reading touch event from %s\n", cl->host); }
+        rfbCloseClient(cl);
+        return true;
+    }
+
+    int count = (uint8_t) header[0];
+    if (count > SUINPUT_MAX_CONTACTS)
+    {
+        LW("Client %s sent too many contacts (%d)\n", cl->host, count);
+        rfbCloseClient(cl);
+        return true;
+    }
+
+    if (count > 0 && (n = rfbReadExact(cl, contacts, count * CONTACT_SIZE)) <= 0)
+    {
+        if (n != 0) { LE("Failed reading touch event from %s\n", cl->host); }
+        rfbCloseClient(cl);
+        return true;
+    }
+
+    touchPoint points[SUINPUT_MAX_CONTACTS];
+    for (int i = 0; i < count; i++)
+    {
+        const char* contact = contacts + i * CONTACT_SIZE;
+        uint16_t values[3];
+        memcpy(&values[0], contact, 2);
+        memcpy(&values[1], contact + 4, 4);
+
+        // contacts are reported in the coordinates of the (scaled) screen the client sees
+        points[i].id = Swap16IfLE(values[0]);
+        points[i].down = (contact[2] & MULTITOUCH_DOWN) != 0;
+        points[i].x = ScaleX(cl->scaledScreen, cl->screen, Swap16IfLE(values[1]));
+        points[i].y = ScaleY(cl->scaledScreen, cl->screen, Swap16IfLE(values[2]));
+    }
+
+    if (!cl->viewOnly) { touchEvent(count, points, cl); }
+    return true;
+}
+
+static rfbBool handleMessage(rfbClientPtr cl, void* data, const rfbClientToServerMsg* message)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL || !state->multitouchSupported || message->type != MSG_MULTITOUCH)
+    {
+        return FALSE;
+    }
+
+    return handleMultitouch(cl);
+}
+
+void initMultitouch(void)
+{
+    memset(&multitouchExtension, 0, sizeof(multitouchExtension));
+    multitouchExtension.pseudoEncodings = multitouchEncodings;
+    multitouchExtension.enablePseudoEncoding = enableEncoding;
+    multitouchExtension.handleMessage = handleMessage;
+
+    rfbRegisterProtocolExtension(&multitouchExtension);
+}
@@ -0,0 +1,39 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef MULTITOUCH_H
+#define MULTITOUCH_H
+
+extern "C" {
+    #include "rfb/rfb.h"
+}
+
+// emteria.OS private extension, a client announces it with the pseudo-encoding
+// and we confirm with a MSG_MULTITOUCH carrying the number of supported contacts:
+//   U8 type, U8 count, U16 padding
+// the client then sends the same header followed by count contacts:
+//   U16 id, U8 flags, U8 padding, U16 x, U16 y
+#define ENCODING_MULTITOUCH 0x454D5401
+#define MSG_MULTITOUCH 238
+
+#define MULTITOUCH_DOWN (1 << 0)
+
+void initMultitouch(void);
+
+#endif
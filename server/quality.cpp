@@ -0,0 +1,254 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <stddef.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "client.h"
+#include "quality.h"
+
+// how often the link of every client is sampled
+#define SAMPLE_INTERVAL ms2ns(250)
+
+// how long a better link has to persist before quality is raised again
+#define UPGRADE_HOLD ms2ns(1000)
+
+// weight of a new sample in the moving averages
+#define EWMA_WEIGHT 0.25
+
+// blocked sends shorter than this do not say anything about the link
+#define MIN_BLOCKED_SEND ms2ns(20)
+#define MIN_BLOCKED_BYTES (16 * 1024)
+
+struct qualityTier
+{
+    double minThroughput; // bytes per second
+    double maxRtt;        // milliseconds
+    int quality;          // tight/JPEG quality level, -1 = lossless
+    int compress;         // zlib/tight compression level
+    int frameInterval;    // milliseconds
+};
+
+// ordered from best to worst link
+static const qualityTier tiers[] = {
+    { 12500000.0,  20.0, -1, 1,  16 }, // 100 Mbit/s LAN
+    {  2500000.0,  60.0,  8, 3,  33 }, // 20 Mbit/s
+    {   625000.0, 150.0,  6, 6,  50 }, // 5 Mbit/s
+    {   125000.0, 300.0,  4, 8, 100 }, // 1 Mbit/s
+    {        0.0,   1e9,  2, 9, 200 }, // congested mobile links
+};
+
+#define TIER_COUNT (sizeof(tiers) / sizeof(qualityTier))
+#define INITIAL_TIER 2
+
+#ifdef LIBVNCSERVER_HAVE_LIBJPEG
+// same mapping libvncserver applies for the quality pseudo-encodings
+static const int turboQuality[10] = { 15, 29, 41, 42, 62, 77, 79, 86, 92, 100 };
+static const int turboSubsamp[10] = { 1, 1, 1, 2, 2, 2, 0, 0, 0, 0 };
+#endif
+
+static double ewma(double average, double sample)
+{
+    if (average <= 0) { return sample; }
+    return average + EWMA_WEIGHT * (sample - average);
+}
+
+static int selectTier(clientState* state)
+{
+    for (unsigned int i = 0; i < TIER_COUNT; i++)
+    {
+        if (state->throughput >= tiers[i].minThroughput && state->rtt <= tiers[i].maxRtt)
+        {
+            return i;
+        }
+    }
+
+    return TIER_COUNT - 1;
+}
+
+static void applyTier(rfbClientPtr cl, clientState* state)
+{
+    const qualityTier* tier = &tiers[state->tier];
+
+    // the viewer changed its quality level since we last touched it,
+    // remember it as the upper limit for this client
+    if (cl->tightQualityLevel != state->quality)
+    {
+        state->clientQuality = cl->tightQualityLevel;
+    }
+
+    int quality = tier->quality;
+    if (state->clientQuality >= 0 && (quality < 0 || state->clientQuality < quality))
+    {
+        quality = state->clientQuality;
+    }
+
+    state->quality = quality;
+    state->compress = tier->compress;
+    state->frameInterval = ms2ns(tier->frameInterval);
+
+    cl->tightQualityLevel = quality;
+    cl->tightCompressLevel = state->compress;
+    cl->zlibCompressLevel = state->compress;
+#ifdef LIBVNCSERVER_HAVE_LIBJPEG
+    cl->turboQualityLevel = (quality < 0) ? -1 : turboQuality[quality];
+    cl->turboSubsampLevel = (quality < 0) ? 0 : turboSubsamp[quality];
+#endif
+}
+
+void initQuality(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL) { return; }
+
+    state->tier = INITIAL_TIER;
+    state->tierSince = systemTime(SYSTEM_TIME_MONOTONIC);
+    state->quality = cl->tightQualityLevel;
+    applyTier(cl, state);
+}
+
+void qualityUpdateStarted(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL) { return; }
+
+    state->updateStart = systemTime(SYSTEM_TIME_MONOTONIC);
+    state->sentAtUpdateStart = rfbStatGetSentBytes(cl);
+}
+
+void qualityUpdateFinished(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL || state->updateStart == 0) { return; }
+
+    nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - state->updateStart;
+    int bytes = rfbStatGetSentBytes(cl) - state->sentAtUpdateStart;
+    state->updateStart = 0;
+
+    // writes only take noticeable time when the socket buffer is full,
+    // so a long send is a direct measurement of what the link drains
+    if (elapsed >= MIN_BLOCKED_SEND && bytes >= MIN_BLOCKED_BYTES)
+    {
+        double throughput = bytes * 1e9 / elapsed;
+        state->throughput = ewma(state->throughput, throughput);
+    }
+}
+
+static bool sampleSocket(rfbClientPtr cl, clientState* state, double seconds)
+{
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    memset(&info, 0, sizeof(info));
+
+    if (getsockopt(cl->sock, IPPROTO_TCP, TCP_INFO, &info, &len) != 0)
+    {
+        // not a TCP socket
+        return false;
+    }
+
+    if (info.tcpi_rtt > 0)
+    {
+        state->rtt = ewma(state->rtt, info.tcpi_rtt / 1000.0);
+    }
+
+    bool hasAcked = len >= offsetof(struct tcp_info, tcpi_bytes_acked) + sizeof(info.tcpi_bytes_acked);
+    bool hasRate = len >= offsetof(struct tcp_info, tcpi_delivery_rate) + sizeof(info.tcpi_delivery_rate);
+
+    if (hasRate && info.tcpi_delivery_rate > 0 && !info.tcpi_delivery_rate_app_limited)
+    {
+        // the kernel saw the link saturated, trust its estimation
+        state->throughput = ewma(state->throughput, (double) info.tcpi_delivery_rate);
+    }
+    else if (hasAcked && state->ackedAtSample > 0 && seconds > 0)
+    {
+        // we did not send enough to fill the link, the goodput is only a lower bound
+        double goodput = (info.tcpi_bytes_acked - state->ackedAtSample) / seconds;
+        if (goodput > state->throughput) { state->throughput = ewma(state->throughput, goodput); }
+    }
+
+    if (hasAcked) { state->ackedAtSample = info.tcpi_bytes_acked; }
+    return true;
+}
+
+void updateQuality(rfbClientPtr cl, nsecs_t now)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL) { return; }
+
+    if (state->lastSample == 0)
+    {
+        state->lastSample = now;
+        state->requestsAtSample = rfbStatGetMessageCountRcvd(cl, rfbFramebufferUpdateRequest);
+        sampleSocket(cl, state, 0);
+        return;
+    }
+
+    if (now - state->lastSample < SAMPLE_INTERVAL) { return; }
+
+    double seconds = (now - state->lastSample) / 1e9;
+    state->lastSample = now;
+
+    int requests = rfbStatGetMessageCountRcvd(cl, rfbFramebufferUpdateRequest);
+    state->requestRate = ewma(state->requestRate, (requests - state->requestsAtSample) / seconds);
+    state->requestsAtSample = requests;
+
+    if (!sampleSocket(cl, state, seconds) && state->requestRate > 0)
+    {
+        // without TCP statistics the request cadence is the best round trip estimation,
+        // since a viewer only asks for the next frame after receiving the previous one
+        state->rtt = ewma(state->rtt, 1000.0 / state->requestRate);
+    }
+
+    if (state->throughput <= 0) { return; }
+
+    // degrade immediately, but upgrade only after the link proved itself
+    int tier = selectTier(state);
+    if (tier > state->tier || (tier < state->tier && now - state->tierSince >= UPGRADE_HOLD))
+    {
+        LD("Client %s: %.0f kB/s, rtt %.1f ms, %.1f req/s -> quality tier %d\n",
+            cl->host, state->throughput / 1000, state->rtt, state->requestRate, tier);
+        state->tier = tier;
+        state->tierSince = now;
+    }
+    else if (tier == state->tier)
+    {
+        state->tierSince = now;
+    }
+
+    applyTier(cl, state);
+}
+
+nsecs_t getFrameDelay(rfbClientPtr cl, nsecs_t now)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL || now >= state->nextFrame) { return 0; }
+
+    return state->nextFrame - now;
+}
+
+void scheduleFrame(rfbClientPtr cl, nsecs_t now)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL) { return; }
+
+    state->nextFrame = now + state->frameInterval;
+}
@@ -0,0 +1,37 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include <utils/Timers.h>
+
+extern "C" {
+    #include "rfb/rfb.h"
+}
+
+void initQuality(rfbClientPtr cl);
+void qualityUpdateStarted(rfbClientPtr cl);
+void qualityUpdateFinished(rfbClientPtr cl);
+void updateQuality(rfbClientPtr cl, nsecs_t now);
+
+nsecs_t getFrameDelay(rfbClientPtr cl, nsecs_t now);
+void scheduleFrame(rfbClientPtr cl, nsecs_t now);
+
+#endif
@@ -0,0 +1,480 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <dirent.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <thread>
+
+#include <utils/Timers.h>
+
+#include "common.h"
+#include "events.h"
+#include "recording.h"
+
+// a new file with a new connection is started beyond this size
+#define RECORD_FILE_LIMIT (64 * 1024 * 1024)
+
+// the oldest recordings are removed to stay below this size
+#define RECORD_TOTAL_LIMIT (1024LL * 1024 * 1024)
+
+// interval of the update requests of the recorder, it sees at most this many frames (ms)
+#define RECORD_INTERVAL 100
+
+// how long the handshake may take (ms)
+#define RECORD_TIMEOUT 5000
+
+// data collected before it is written to the file
+#define RECORD_BUFFER (256 * 1024)
+
+#define RECORD_CHUNK (64 * 1024)
+
+#define FBS_VERSION "FBS 001.000\n"
+
+struct recorder
+{
+    std::thread thread;
+    std::atomic<bool> full;     // the file reached its limit, the connection should end
+    std::atomic<bool> finished; // the thread is done, the event loop cleans up
+    std::atomic<bool> failed;
+    bool connecting; // libvncserver is adding the client
+    bool stopping;
+
+    rfbClientPtr cl; // until libvncserver let go of it
+    int serverSock; // our client in libvncserver, until it got closed
+    int sock;       // the end we read from
+    char* password;
+    uint16_t width;
+    uint16_t height;
+
+    int file;
+    char* buffer;
+    size_t buffered;
+    int64_t written;
+    nsecs_t started;
+};
+
+static char* recordDirectory = NULL;
+static recorder* current = NULL;
+static int fileCount = 0;
+
+static bool flushFile(recorder* rec)
+{
+    size_t offset = 0;
+    while (offset < rec->buffered)
+    {
+        ssize_t result = write(rec->file, rec->buffer + offset, rec->buffered - offset);
+        if (result < 0 && errno == EINTR) { continue; }
+        if (result <= 0)
+        {
+            LE("Failed writing recording (errno %d)\n", errno);
+            return false;
+        }
+
+        offset += result;
+    }
+
+    rec->buffered = 0;
+    return true;
+}
+
+static bool appendFile(recorder* rec, const void* data, size_t length)
+{
+    const char* bytes = (const char*) data;
+    while (length > 0)
+    {
+        if (rec->buffered == RECORD_BUFFER && !flushFile(rec)) { return false; }
+
+        size_t part = RECORD_BUFFER - rec->buffered;
+        if (part > length) { part = length; }
+        memcpy(rec->buffer + rec->buffered, bytes, part);
+
+        rec->buffered += part;
+        rec->written += part;
+        bytes += part;
+        length -= part;
+    }
+
+    return true;
+}
+
+// data padded to four bytes, between its length and the time since the start in milliseconds
+static bool appendBlock(recorder* rec, const void* data, uint32_t length)
+{
+    uint32_t timestamp = (uint32_t) ns2ms(systemTime(SYSTEM_TIME_MONOTONIC) - rec->started);
+    uint32_t lengthBE = htonl(length);
+    uint32_t timestampBE = htonl(timestamp);
+    static const char padding[4] = { 0, 0, 0, 0 };
+
+    return appendFile(rec, &lengthBE, 4) && appendFile(rec, data, length) &&
+        appendFile(rec, padding, (4 - length % 4) % 4) && appendFile(rec, &timestampBE, 4);
+}
+
+static bool readExact(recorder* rec, void* data, size_t length)
+{
+    char* bytes = (char*) data;
+    struct pollfd pfd = { rec->sock, POLLIN, 0 };
+    while (length > 0)
+    {
+        if (poll(&pfd, 1, RECORD_TIMEOUT) <= 0) { return false; }
+
+        ssize_t result = read(rec->sock, bytes, length);
+        if (result < 0 && (errno == EINTR || errno == EAGAIN)) { continue; }
+        if (result <= 0) { return false; }
+
+        bytes += result;
+        length -= result;
+    }
+
+    return true;
+}
+
+static bool writeExact(recorder* rec, const void* data, size_t length)
+{
+    return send(rec->sock, data, length, MSG_NOSIGNAL) == (ssize_t) length;
+}
+
+static bool authenticate(recorder* rec)
+{
+    uint8_t count;
+    uint8_t types[256];
+    if (!readExact(rec, &count, 1) || count == 0 || !readExact(rec, types, count)) { return false; }
+
+    uint8_t chosen = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (types[i] == rfbNoAuth || (types[i] == rfbVncAuth && rec->password != NULL)) { chosen = types[i]; }
+    }
+    if (chosen == 0 || !writeExact(rec, &chosen, 1)) { return false; }
+
+    if (chosen == rfbVncAuth)
+    {
+        unsigned char challenge[CHALLENGESIZE];
+        if (!readExact(rec, challenge, CHALLENGESIZE)) { return false; }
+
+        rfbEncryptBytes(challenge, rec->password);
+        if (!writeExact(rec, challenge, CHALLENGESIZE)) { return false; }
+    }
+
+    uint32_t result;
+    return readExact(rec, &result, 4) && result == 0;
+}
+
+// the file starts like a connection to a server without authentication,
+// the rest of the handshake is not recorded
+static bool handshake(recorder* rec)
+{
+    char version[sz_rfbProtocolVersionMsg + 1];
+    if (!readExact(rec, version, sz_rfbProtocolVersionMsg)) { return false; }
+
+    snprintf(version, sizeof(version), rfbProtocolVersionFormat, 3, 8);
+    if (!writeExact(rec, version, sz_rfbProtocolVersionMsg) || !authenticate(rec)) { return false; }
+
+    uint8_t shared = 1;
+    rfbServerInitMsg init;
+    if (!writeExact(rec, &shared, 1) || !readExact(rec, &init, sz_rfbServerInitMsg)) { return false; }
+
+    rec->width = ntohs(init.framebufferWidth);
+    rec->height = ntohs(init.framebufferHeight);
+    uint32_t nameLength = ntohl(init.nameLength);
+    size_t length = sz_rfbProtocolVersionMsg + 4 + sz_rfbServerInitMsg + nameLength;
+    char* start = (char*) malloc(length);
+    if (start == NULL) { return false; }
+
+    snprintf(start, sz_rfbProtocolVersionMsg + 1, rfbProtocolVersionFormat, 3, 3);
+    uint32_t noAuth = htonl(rfbNoAuth);
+    memcpy(start + sz_rfbProtocolVersionMsg, &noAuth, 4);
+    memcpy(start + sz_rfbProtocolVersionMsg + 4, &init, sz_rfbServerInitMsg);
+
+    bool result = readExact(rec, start + sz_rfbProtocolVersionMsg + 4 + sz_rfbServerInitMsg, nameLength) &&
+        appendFile(rec, FBS_VERSION, strlen(FBS_VERSION)) && appendBlock(rec, start, length);
+    free(start);
+    if (!result) { return false; }
+
+    // ZRLE is lossless, compact and replayed by most viewers
+    struct { rfbSetEncodingsMsg msg; uint32_t encodings[1]; } setEncodings;
+    setEncodings.msg.type = rfbSetEncodings;
+    setEncodings.msg.pad = 0;
+    setEncodings.msg.nEncodings = htons(1);
+    setEncodings.encodings[0] = htonl(rfbEncodingZRLE);
+    return writeExact(rec, &setEncodings, sz_rfbSetEncodingsMsg + 4);
+}
+
+static bool requestUpdate(recorder* rec, bool incremental)
+{
+    rfbFramebufferUpdateRequestMsg request;
+    request.type = rfbFramebufferUpdateRequest;
+    request.incremental = incremental;
+    request.x = 0;
+    request.y = 0;
+    request.w = htons(rec->width);
+    request.h = htons(rec->height);
+
+    return writeExact(rec, &request, sz_rfbFramebufferUpdateRequestMsg);
+}
+
+// everything libvncserver sends is recorded as it arrives, until it closes the connection
+static void record(recorder* rec)
+{
+    char* chunk = (char*) malloc(RECORD_CHUNK);
+    if (chunk == NULL) { return; }
+
+    bool incremental = false;
+    nsecs_t nextRequest = 0;
+    struct pollfd pfd = { rec->sock, POLLIN, 0 };
+    while (true)
+    {
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (now >= nextRequest)
+        {
+            // the first update holds the whole screen, so the file can be played on its own
+            requestUpdate(rec, incremental);
+            incremental = true;
+            nextRequest = now + ms2ns(RECORD_INTERVAL);
+        }
+
+        int result = poll(&pfd, 1, (int) ns2ms(nextRequest - now) + 1);
+        if (result < 0 && errno != EINTR) { break; }
+        if (result <= 0) { continue; }
+
+        ssize_t length = read(rec->sock, chunk, RECORD_CHUNK);
+        if (length < 0 && (errno == EINTR || errno == EAGAIN)) { continue; }
+        if (length <= 0) { break; }
+
+        // a full or broken disk would fail the next file just the same
+        if (!appendBlock(rec, chunk, length))
+        {
+            rec->failed = true;
+            break;
+        }
+
+        // libvncserver only closes the connection between two updates
+        if (rec->written >= RECORD_FILE_LIMIT && !rec->full)
+        {
+            rec->full = true;
+            wakeEvents();
+        }
+    }
+
+    free(chunk);
+}
+
+static int isRecording(const struct dirent* entry)
+{
+    return strncmp(entry->d_name, "vncd-", 5) == 0 && strstr(entry->d_name, ".fbs") != NULL;
+}
+
+// the names sort by their start time, the oldest go first
+static void pruneRecordings(void)
+{
+    struct dirent** entries;
+    int count = scandir(recordDirectory, &entries, isRecording, alphasort);
+    if (count < 0) { return; }
+
+    int64_t total = 0;
+    int64_t* sizes = (int64_t*) calloc(count + 1, sizeof(int64_t));
+    char path[PATH_MAX];
+    for (int i = 0; i < count && sizes != NULL; i++)
+    {
+        struct stat info;
+        snprintf(path, sizeof(path), "%s/%s", recordDirectory, entries[i]->d_name);
+        sizes[i] = (stat(path, &info) == 0) ? info.st_size : 0;
+        total += sizes[i];
+    }
+
+    // room for the file which is started next
+    for (int i = 0; i < count && sizes != NULL && total > RECORD_TOTAL_LIMIT - RECORD_FILE_LIMIT; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", recordDirectory, entries[i]->d_name);
+        if (unlink(path) == 0)
+        {
+            L("Removed recording %s to stay within the size limit\n", path);
+            total -= sizes[i];
+        }
+    }
+
+    for (int i = 0; i < count; i++) { free(entries[i]); }
+    free(entries);
+    free(sizes);
+}
+
+static bool openFile(recorder* rec)
+{
+    pruneRecordings();
+
+    char date[32];
+    char path[PATH_MAX];
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y%m%d-%H%M%S", localtime(&now));
+    snprintf(path, sizeof(path), "%s/vncd-%s-%03d.fbs", recordDirectory, date, fileCount++ % 1000);
+
+    // sessions may contain anything on the screen
+    rec->file = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (rec->file < 0)
+    {
+        LE("Failed creating recording %s (errno %d)\n", path, errno);
+        return false;
+    }
+
+    L("Recording session to %s\n", path);
+    return true;
+}
+
+static void recorderThread(recorder* rec)
+{
+    rec->started = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (!openFile(rec))
+    {
+        rec->failed = true;
+    }
+    else if (!handshake(rec))
+    {
+        LE("Failed connecting the recorder\n");
+        rec->failed = true;
+    }
+    else
+    {
+        record(rec);
+    }
+
+    if (rec->file >= 0)
+    {
+        if (!flushFile(rec)) { rec->failed = true; }
+        close(rec->file);
+        L("Recorded %lld bytes in %.1f s\n", (long long) rec->written,
+            (systemTime(SYSTEM_TIME_MONOTONIC) - rec->started) / 1e9);
+    }
+
+    rec->finished = true;
+    wakeEvents();
+}
+
+void initRecording(const char* directory)
+{
+    if (mkdir(directory, 0700) != 0 && errno != EEXIST)
+    {
+        LE("Failed creating recording directory %s (errno %d)\n", directory, errno);
+        return;
+    }
+
+    recordDirectory = strdup(directory);
+}
+
+static void startRecorder(rfbScreenInfoPtr screen)
+{
+    int socks[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, socks) != 0)
+    {
+        LE("Failed creating recorder connection (errno %d)\n", errno);
+        return;
+    }
+
+    recorder* rec = new recorder();
+    rec->full = false;
+    rec->finished = false;
+    rec->failed = false;
+    rec->stopping = false;
+    rec->file = -1;
+    rec->sock = socks[1];
+    rec->serverSock = socks[0];
+    rec->buffer = (char*) malloc(RECORD_BUFFER);
+    rec->password = (screen->authPasswdData != NULL) ? rfbDecryptPasswdFromFile((char*) screen->authPasswdData) : NULL;
+    current = rec;
+
+    // the new client hook recognizes the recorder by its socket
+    rec->connecting = true;
+    rec->cl = rfbNewClient(screen, rec->serverSock);
+    rec->connecting = false;
+    if (rec->cl == NULL || rec->buffer == NULL)
+    {
+        LE("Failed adding the recorder as a client\n");
+        if (rec->cl == NULL) { close(rec->serverSock); }
+        rec->failed = true;
+        rec->finished = true;
+        return;
+    }
+
+    rec->thread = std::thread(recorderThread, rec);
+}
+
+static void stopRecorder(void)
+{
+    // the connection ends after the update in progress, the thread sees it closed
+    if (current->cl != NULL && !current->stopping)
+    {
+        rfbCloseClient(current->cl);
+        current->stopping = true;
+    }
+}
+
+static void freeRecorder(void)
+{
+    recorder* rec = current;
+    if (rec->thread.joinable()) { rec->thread.join(); }
+
+    if (rec->failed)
+    {
+        // retrying would fail the same way on every loop
+        LE("Recording stopped\n");
+        free(recordDirectory);
+        recordDirectory = NULL;
+    }
+
+    if (rec->cl != NULL && !rec->stopping) { rfbCloseClient(rec->cl); }
+    close(rec->sock);
+    free(rec->buffer);
+    free(rec->password);
+    delete rec;
+    current = NULL;
+}
+
+// only valid in the new client hook, the client state remembers it afterwards
+bool isRecorder(rfbClientPtr cl)
+{
+    return current != NULL && current->connecting && cl->sock == current->serverSock;
+}
+
+void recorderGone(rfbClientPtr cl)
+{
+    if (current != NULL && current->cl == cl) { current->cl = NULL; }
+}
+
+// the recorder follows the sessions of real viewers, a full file is continued
+// in a new one with a new connection, so both can be played on their own
+void updateRecording(rfbScreenInfoPtr screen, int viewers)
+{
+    if (current != NULL)
+    {
+        if (current->finished) { freeRecorder(); }
+        else if (viewers == 0 || current->full) { stopRecorder(); }
+    }
+
+    if (current == NULL && viewers > 0 && recordDirectory != NULL) { startRecorder(screen); }
+}
+
+// libvncserver closed all connections already, the thread writes what is left
+void closeRecording(void)
+{
+    if (current == NULL) { return; }
+
+    stopRecorder();
+    freeRecorder();
+}
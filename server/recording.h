@@ -0,0 +1,35 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef RECORDING_H
+#define RECORDING_H
+
+extern "C" {
+    #include "rfb/rfb.h"
+}
+
+// sessions are recorded by an internal viewer connected through a socket pair,
+// it writes what libvncserver sends to it into FBS files (rfbproxy format)
+void initRecording(const char* directory);
+bool isRecorder(rfbClientPtr cl);
+void recorderGone(rfbClientPtr cl);
+void updateRecording(rfbScreenInfoPtr screen, int viewers);
+void closeRecording(void);
+
+#endif
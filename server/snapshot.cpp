@@ -0,0 +1,512 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <limits.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <sys/socket.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <jpeglib.h>
+#include <png.h>
+#include <zlib.h>
+
+#include "common.h"
+#include "flinger.h"
+#include "capture.h"
+#include "snapshot.h"
+
+extern screenFormat screenformat;
+
+// requests waiting for a frame or the encoder, more are turned away
+#define SNAPSHOT_QUEUE 8
+
+// a frame captured this long before the request is recent enough (ms)
+#define SNAPSHOT_MAX_AGE 100
+
+// how long a requester may take to receive the image (ms)
+#define SNAPSHOT_SEND_WAIT 2000
+
+#define SNAPSHOT_QUALITY 80
+
+enum snapshotFormat
+{
+    SNAPSHOT_PNG,
+    SNAPSHOT_JPEG
+};
+
+struct snapshotRequest
+{
+    int fd;
+    snapshotFormat format;
+    int scale;
+    int quality;
+    nsecs_t time;
+};
+
+typedef std::vector<uint8_t> snapshotData;
+
+struct snapshotJob
+{
+    snapshotRequest request;
+    uint32_t generation;
+
+    // either the cached image or the frame to encode
+    std::shared_ptr<snapshotData> image;
+    std::shared_ptr<snapshotData> frame;
+};
+
+// the last encoded image and what it was made from
+struct snapshotCache
+{
+    uint32_t generation;
+    snapshotFormat format;
+    int scale;
+    int quality;
+    std::shared_ptr<snapshotData> image;
+};
+
+static std::deque<snapshotRequest> waiting;
+
+static std::mutex snapshotMutex;
+static std::condition_variable snapshotCond;
+static std::deque<snapshotJob> jobs;
+static snapshotCache cache;
+static bool running = false;
+
+struct jpegError
+{
+    struct jpeg_error_mgr manager;
+    jmp_buf jump;
+};
+
+static void sendAll(int fd, const void* data, size_t size)
+{
+    const char* bytes = (const char*) data;
+    while (size > 0)
+    {
+        ssize_t written = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) { continue; }
+        if (written <= 0) { return; }
+
+        bytes += written;
+        size -= written;
+    }
+}
+
+static void sendResponse(int fd, const char* status, const char* type, const void* body, size_t length)
+{
+    char header[256];
+    int size = snprintf(header, sizeof(header), "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        status, type, length);
+
+    sendAll(fd, header, size);
+    sendAll(fd, body, length);
+}
+
+static void sendError(int fd, const char* status)
+{
+    char body[64];
+    int length = snprintf(body, sizeof(body), "%s\n", status);
+    sendResponse(fd, status, "text/plain", body, length);
+}
+
+// copies the value of a "key=value" parameter, false if the parameter is another one
+static bool readParameter(const char* parameter, const char* end, const char* key, char* value, size_t size)
+{
+    size_t keyLength = strlen(key);
+    if ((size_t) (end - parameter) <= keyLength || strncmp(parameter, key, keyLength) != 0 || parameter[keyLength] != '=')
+    {
+        return false;
+    }
+
+    const char* start = parameter + keyLength + 1;
+    size_t length = end - start;
+    if (length >= size) { length = size - 1; }
+    memcpy(value, start, length);
+    value[length] = 0;
+    return true;
+}
+
+// the target follows the path, e.g. "?format=jpeg&scale=50 HTTP/1.1"
+static bool parseRequest(const char* target, snapshotRequest* request)
+{
+    request->format = SNAPSHOT_PNG;
+    request->scale = 100;
+    request->quality = SNAPSHOT_QUALITY;
+
+    if (*target == ' ') { return true; }
+    if (*target != '?') { return false; }
+
+    const char* end = strchr(target, ' ');
+    if (end == NULL) { return false; }
+
+    const char* parameter = target + 1;
+    while (parameter < end)
+    {
+        const char* next = (const char*) memchr(parameter, '&', end - parameter);
+        if (next == NULL) { next = end; }
+
+        char value[16];
+        if (readParameter(parameter, next, "format", value, sizeof(value)))
+        {
+            if (strcmp(value, "png") == 0) { request->format = SNAPSHOT_PNG; }
+            else if (strcmp(value, "jpeg") == 0 || strcmp(value, "jpg") == 0) { request->format = SNAPSHOT_JPEG; }
+            else { return false; }
+        }
+        else if (readParameter(parameter, next, "scale", value, sizeof(value)))
+        {
+            request->scale = atoi(value);
+            if (request->scale < 1 || request->scale > 100) { return false; }
+        }
+        else if (readParameter(parameter, next, "quality", value, sizeof(value)))
+        {
+            request->quality = atoi(value);
+            if (request->quality < 1 || request->quality > 100) { return false; }
+        }
+        else if (next > parameter)
+        {
+            return false;
+        }
+
+        parameter = next + 1;
+    }
+
+    return true;
+}
+
+// averages the frame pixels covered by each pixel of an output row into RGB
+static void scaleRow(const uint8_t* frame, int width, int height, int y, uint8_t* rgb)
+{
+    int bytesPerPixel = screenformat.bitsPerPixel / CHAR_BIT;
+    int shifts[3] = { screenformat.redShift, screenformat.greenShift, screenformat.blueShift };
+    uint32_t masks[3] = {
+        (1u << screenformat.redMax) - 1, (1u << screenformat.greenMax) - 1, (1u << screenformat.blueMax) - 1
+    };
+
+    int y0 = y * screenformat.height / height;
+    int y1 = (y + 1) * screenformat.height / height;
+    if (y1 <= y0) { y1 = y0 + 1; }
+
+    for (int x = 0; x < width; x++)
+    {
+        int x0 = x * screenformat.width / width;
+        int x1 = (x + 1) * screenformat.width / width;
+        if (x1 <= x0) { x1 = x0 + 1; }
+
+        uint32_t sums[3] = { 0, 0, 0 };
+        for (int sy = y0; sy < y1; sy++)
+        {
+            const uint8_t* pixel = frame + ((size_t) sy * screenformat.width + x0) * bytesPerPixel;
+            for (int sx = x0; sx < x1; sx++, pixel += bytesPerPixel)
+            {
+                uint32_t value = 0;
+                switch (bytesPerPixel)
+                {
+                    case 4: value = *(const uint32_t*) pixel; break;
+                    case 3: value = pixel[0] | (pixel[1] << 8) | (pixel[2] << 16); break;
+                    case 2: value = *(const uint16_t*) pixel; break;
+                    default: value = pixel[0]; break;
+                }
+
+                for (int c = 0; c < 3; c++) { sums[c] += (value >> shifts[c]) & masks[c]; }
+            }
+        }
+
+        uint32_t count = (x1 - x0) * (y1 - y0);
+        for (int c = 0; c < 3; c++)
+        {
+            rgb[x * 3 + c] = (masks[c] > 0) ? sums[c] * 255 / masks[c] / count : 0;
+        }
+    }
+}
+
+static void pngWrite(png_structp png, png_bytep data, png_size_t length)
+{
+    snapshotData* image = (snapshotData*) png_get_io_ptr(png);
+    image->insert(image->end(), data, data + length);
+}
+
+static void pngFlush(png_structp png)
+{
+}
+
+static bool encodePng(const uint8_t* frame, int width, int height, snapshotData* image)
+{
+    uint8_t* row = (uint8_t*) malloc(width * 3);
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = (png != NULL) ? png_create_info_struct(png) : NULL;
+    if (row == NULL || info == NULL)
+    {
+        png_destroy_write_struct(&png, NULL);
+        free(row);
+        return false;
+    }
+
+    if (setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_write_struct(&png, &info);
+        free(row);
+        return false;
+    }
+
+    png_set_write_fn(png, image, pngWrite, pngFlush);
+    png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+        PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+    // screen content compresses well already at the fastest level
+    png_set_compression_level(png, Z_BEST_SPEED);
+    png_write_info(png, info);
+
+    for (int y = 0; y < height; y++)
+    {
+        scaleRow(frame, width, height, y, row);
+        png_write_row(png, row);
+    }
+
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+    free(row);
+    return true;
+}
+
+static void jpegErrorExit(j_common_ptr cinfo)
+{
+    longjmp(((jpegError*) cinfo->err)->jump, 1);
+}
+
+static bool encodeJpeg(const uint8_t* frame, int width, int height, int quality, snapshotData* image)
+{
+    uint8_t* row = (uint8_t*) malloc(width * 3);
+    if (row == NULL) { return false; }
+
+    struct jpeg_compress_struct cinfo;
+    jpegError error;
+    unsigned char* buffer = NULL;
+    unsigned long size = 0;
+
+    // libjpeg exits the process on errors unless we jump out
+    cinfo.err = jpeg_std_error(&error.manager);
+    error.manager.error_exit = jpegErrorExit;
+    if (setjmp(error.jump))
+    {
+        jpeg_destroy_compress(&cinfo);
+        free(buffer);
+        free(row);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buffer, &size);
+
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.dct_method = JDCT_IFAST;
+    jpeg_start_compress(&cinfo, TRUE);
+
+    while (cinfo.next_scanline < cinfo.image_height)
+    {
+        scaleRow(frame, width, height, cinfo.next_scanline, row);
+        JSAMPROW rows[1] = { row };
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    image->assign(buffer, buffer + size);
+
+    jpeg_destroy_compress(&cinfo);
+    free(buffer);
+    free(row);
+    return true;
+}
+
+static bool isCached(const snapshotRequest* request, uint32_t generation)
+{
+    return cache.image != nullptr && cache.generation == generation && cache.format == request->format &&
+        cache.scale == request->scale && (request->format == SNAPSHOT_PNG || cache.quality == request->quality);
+}
+
+static void serveJob(snapshotJob* job)
+{
+    snapshotRequest* request = &job->request;
+    std::shared_ptr<snapshotData> image = job->image;
+    if (image == nullptr)
+    {
+        // an earlier request in the queue might have encoded the same image
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        if (isCached(request, job->generation)) { image = cache.image; }
+    }
+
+    if (image == nullptr)
+    {
+        int width = screenformat.width * request->scale / 100;
+        int height = screenformat.height * request->scale / 100;
+        if (width < 1) { width = 1; }
+        if (height < 1) { height = 1; }
+
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        image = std::make_shared<snapshotData>();
+        bool encoded = (request->format == SNAPSHOT_PNG) ?
+            encodePng(job->frame->data(), width, height, image.get()) :
+            encodeJpeg(job->frame->data(), width, height, request->quality, image.get());
+        job->frame.reset();
+
+        if (!encoded)
+        {
+            LE("Failed encoding %dx%d snapshot\n", width, height);
+            sendError(request->fd, "500 Internal Server Error");
+            close(request->fd);
+            return;
+        }
+
+        LD("Encoded %dx%d snapshot of frame %u into %zu bytes in %.1f ms\n", width, height, job->generation,
+            image->size(), (systemTime(SYSTEM_TIME_MONOTONIC) - start) / 1e6);
+
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        cache.generation = job->generation;
+        cache.format = request->format;
+        cache.scale = request->scale;
+        cache.quality = request->quality;
+        cache.image = image;
+    }
+
+    // the metrics endpoint set a short timeout meant for its small responses
+    struct timeval timeout = { SNAPSHOT_SEND_WAIT / 1000, (SNAPSHOT_SEND_WAIT % 1000) * 1000 };
+    setsockopt(request->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    const char* type = (request->format == SNAPSHOT_PNG) ? "image/png" : "image/jpeg";
+    sendResponse(request->fd, "200 OK", type, image->data(), image->size());
+    close(request->fd);
+}
+
+static void snapshotThread()
+{
+    while (true)
+    {
+        snapshotJob job;
+        {
+            std::unique_lock<std::mutex> lock(snapshotMutex);
+            snapshotCond.wait(lock, [] { return !jobs.empty() || !running; });
+            if (!running) { break; }
+
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        serveJob(&job);
+    }
+}
+
+int initSnapshots(void)
+{
+    running = true;
+    std::thread(snapshotThread).detach();
+    return 0;
+}
+
+// takes over the connection unless the request was answered right away
+bool requestSnapshot(int fd, const char* target)
+{
+    snapshotRequest request;
+    if (!parseRequest(target, &request))
+    {
+        sendError(fd, "400 Bad Request");
+        return false;
+    }
+
+    size_t queued;
+    {
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        queued = jobs.size();
+    }
+
+    if (waiting.size() + queued >= SNAPSHOT_QUEUE)
+    {
+        sendError(fd, "503 Service Unavailable");
+        return false;
+    }
+
+    request.fd = fd;
+    request.time = systemTime(SYSTEM_TIME_MONOTONIC);
+    waiting.push_back(request);
+    return true;
+}
+
+// called by the event loop, hands the requests to the encoder once a recent frame is there
+void updateSnapshots(void)
+{
+    if (waiting.empty()) { return; }
+
+    // one copy serves all requests of a frame, the capture thread writes the other buffer meanwhile
+    std::shared_ptr<snapshotData> frame;
+    uint32_t generation = getFrameGeneration();
+    nsecs_t latest = getLatestCaptureTime();
+    while (!waiting.empty() && latest > 0 && latest >= waiting.front().time - ms2ns(SNAPSHOT_MAX_AGE))
+    {
+        snapshotJob job;
+        job.request = waiting.front();
+        job.generation = generation;
+        waiting.pop_front();
+
+        {
+            std::lock_guard<std::mutex> lock(snapshotMutex);
+            if (isCached(&job.request, generation)) { job.image = cache.image; }
+        }
+
+        if (job.image == nullptr)
+        {
+            if (frame == nullptr)
+            {
+                const uint8_t* pixels = (const uint8_t*) getFrontBuffer();
+                size_t size = screenformat.width * screenformat.height * screenformat.bitsPerPixel / CHAR_BIT;
+                frame = std::make_shared<snapshotData>(pixels, pixels + size);
+            }
+            job.frame = frame;
+        }
+
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        jobs.push_back(job);
+        snapshotCond.notify_one();
+    }
+
+    // without clients the loop does not capture at all, with them it might be idling
+    if (!waiting.empty() && !isCaptureBusy()) { requestCapture(); }
+}
+
+void closeSnapshots(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        running = false;
+        snapshotCond.notify_one();
+    }
+
+    for (const snapshotRequest& request : waiting) { close(request.fd); }
+    waiting.clear();
+}
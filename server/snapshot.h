@@ -0,0 +1,34 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+// screenshots of the latest captured frame, served by the metrics endpoint:
+//
+//   GET /snapshot?format=png|jpeg&scale=<percent>&quality=<1-100>
+//
+// frames are copied on the main thread and encoded and sent by a thread of their own,
+// the last image is reused as long as the screen did not change
+int initSnapshots(void);
+bool requestSnapshot(int fd, const char* target);
+void updateSnapshots(void);
+void closeSnapshots(void);
+
+#endif
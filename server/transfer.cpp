@@ -0,0 +1,349 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+
+#include <atomic>
+#include <thread>
+
+#include <utils/Timers.h>
+
+#include "common.h"
+#include "client.h"
+#include "backlog.h"
+#include "events.h"
+#include "transfer.h"
+
+// share of the tolerated socket queue left to the file, the rest is kept for frames
+#define TRANSFER_SHARE 2
+
+// smallest queue the transfer may fill regardless of the link estimation
+#define MIN_WINDOW (32 * 1024)
+
+// how long to wait for the queue to drain before checking again (us)
+#define WINDOW_WAIT 2000
+
+// how long a write may wait for a full socket before checking for cancellation (ms),
+// the viewer is given up after rfbMaxClientWait like libvncserver does
+#define SOCKET_WAIT 100
+
+// interval of progress reports (s)
+#define TRANSFER_REPORT 5
+
+struct fileTransfer
+{
+    std::thread thread;
+    std::atomic<bool> running;
+    std::atomic<bool> finished;
+    std::atomic<bool> timedOut; // the viewer stopped reading, the event loop closes it
+    std::atomic<int> window;
+    bool updateLocked;          // the event loop holds sendMutex for a frame
+
+    rfbClientPtr cl;
+    int file;
+    int sock;   // duplicate, stays valid if libvncserver closes the client
+    int marker; // left to libvncserver in place of the file, it closes it on abort
+
+    off_t size;
+    off_t sent;
+    nsecs_t started;
+};
+
+static bool waitWritable(fileTransfer* transfer)
+{
+    struct pollfd pfd = { transfer->sock, POLLOUT, 0 };
+    int waited = 0;
+    while (transfer->running)
+    {
+        int result = poll(&pfd, 1, SOCKET_WAIT);
+        if (result > 0) { return (pfd.revents & (POLLERR | POLLHUP)) == 0; }
+        if (result < 0 && errno != EINTR) { return false; }
+
+        // sendMutex is held meanwhile, so the event loop would wait just as long
+        waited += SOCKET_WAIT;
+        if (waited >= rfbMaxClientWait)
+        {
+            LW("File transfer to %s timed out after %d ms\n", transfer->cl->host, waited);
+            transfer->timedOut = true;
+            return false;
+        }
+    }
+
+    return false;
+}
+
+static bool sendAll(fileTransfer* transfer, const char* data, size_t size, int flags)
+{
+    while (size > 0)
+    {
+        ssize_t written = send(transfer->sock, data, size, flags | MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (written < 0)
+        {
+            if (errno == EINTR) { continue; }
+            if (errno == EAGAIN && waitWritable(transfer)) { continue; }
+            return false;
+        }
+
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+// the file goes from the page cache to the socket without passing user space
+static bool sendFile(fileTransfer* transfer, size_t size)
+{
+    off_t offset = transfer->sent;
+    while (size > 0)
+    {
+        ssize_t written = sendfile(transfer->sock, transfer->file, &offset, size);
+        if (written < 0)
+        {
+            if (errno == EINTR) { continue; }
+            if (errno == EAGAIN && waitWritable(transfer)) { continue; }
+            return false;
+        }
+
+        // the file shrank, the packet cannot be completed anymore
+        if (written == 0) { return false; }
+        size -= written;
+    }
+
+    return true;
+}
+
+static bool sendPacket(fileTransfer* transfer, uint8_t contentType, size_t length)
+{
+    char header[sz_rfbFileTransferMsg];
+    uint32_t size = 0;
+    uint32_t lengthBE = Swap32IfLE((uint32_t) length);
+
+    header[0] = rfbFileTransfer;
+    header[1] = contentType;
+    header[2] = 0; // uncompressed
+    header[3] = 0;
+    memcpy(header + 4, &size, 4);
+    memcpy(header + 8, &lengthBE, 4);
+
+    // frames may go out between two packets
+    LOCK(transfer->cl->sendMutex);
+    bool result = sendAll(transfer, header, sizeof(header), (length > 0) ? MSG_MORE : 0);
+    if (result && length > 0) { result = sendFile(transfer, length); }
+    UNLOCK(transfer->cl->sendMutex);
+
+    return result;
+}
+
+// returns the bytes which may be queued now, 0 once the transfer got cancelled
+static int waitForWindow(fileTransfer* transfer)
+{
+    while (transfer->running)
+    {
+        int queued = 0;
+        ioctl(transfer->sock, SIOCOUTQ, &queued);
+
+        int window = transfer->window;
+        if (queued < window) { return window - queued; }
+
+        usleep(WINDOW_WAIT);
+    }
+
+    return 0;
+}
+
+static void reportProgress(fileTransfer* transfer, const char* what)
+{
+    double seconds = (systemTime(SYSTEM_TIME_MONOTONIC) - transfer->started) / 1e9;
+    double rate = (seconds > 0) ? transfer->sent / seconds / (1024 * 1024) : 0;
+
+    L("File transfer to %s %s: %lld of %lld bytes in %.1f s (%.2f MB/s)\n",
+        transfer->cl->host, what, (long long) transfer->sent, (long long) transfer->size, seconds, rate);
+}
+
+static void transferThread(fileTransfer* transfer)
+{
+    nsecs_t lastReport = transfer->started;
+    while (transfer->running && transfer->sent < transfer->size)
+    {
+        int budget = waitForWindow(transfer);
+        while (budget > 0 && transfer->running && transfer->sent < transfer->size)
+        {
+            // viewers expect packets no larger than the blocks libvncserver sends
+            off_t remaining = transfer->size - transfer->sent;
+            size_t length = (remaining < sz_rfbBlockSize) ? remaining : sz_rfbBlockSize;
+            if (!sendPacket(transfer, rfbFilePacket, length))
+            {
+                transfer->running = false;
+                break;
+            }
+
+            transfer->sent += length;
+            budget -= length;
+        }
+
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (now - lastReport >= s2ns(TRANSFER_REPORT))
+        {
+            reportProgress(transfer, "in progress");
+            lastReport = now;
+        }
+    }
+
+    bool complete = transfer->running && sendPacket(transfer, rfbEndOfFile, 0);
+    reportProgress(transfer, complete ? "finished" : "stopped");
+
+    // the event loop cleans up
+    transfer->finished = true;
+    wakeEvents();
+}
+
+// libvncserver opened the file and sent the header, the packets are sent from here on
+static void startTransfer(rfbClientPtr cl, clientState* state)
+{
+    struct stat info;
+    if (fstat(cl->fileTransfer.fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0)
+    {
+        // files of unknown length stay with libvncserver
+        return;
+    }
+
+    fileTransfer* transfer = new fileTransfer();
+    transfer->cl = cl;
+    transfer->file = cl->fileTransfer.fd;
+    transfer->sock = dup(cl->sock);
+    transfer->marker = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (transfer->sock < 0 || transfer->marker < 0)
+    {
+        LE("Failed taking over file transfer to %s (errno %d)\n", cl->host, errno);
+        if (transfer->sock >= 0) { close(transfer->sock); }
+        if (transfer->marker >= 0) { close(transfer->marker); }
+        delete transfer;
+        return;
+    }
+
+    // libvncserver might have sent the first chunks already
+    transfer->size = info.st_size;
+    transfer->sent = lseek(transfer->file, 0, SEEK_CUR);
+    transfer->started = systemTime(SYSTEM_TIME_MONOTONIC);
+    transfer->window = MIN_WINDOW;
+    transfer->running = true;
+    transfer->finished = false;
+    transfer->timedOut = false;
+    transfer->updateLocked = false;
+
+    // libvncserver stops sending chunks but still notices an abort
+    cl->fileTransfer.fd = transfer->marker;
+    cl->fileTransfer.sending = 0;
+
+    L("Streaming %lld bytes to %s\n", (long long) transfer->size, cl->host);
+    state->transfer = transfer;
+    transfer->thread = std::thread(transferThread, transfer);
+}
+
+static void endTransfer(rfbClientPtr cl, clientState* state)
+{
+    fileTransfer* transfer = state->transfer;
+    transfer->running = false;
+    if (transfer->updateLocked) { UNLOCK(cl->sendMutex); }
+    transfer->thread.join();
+
+    // otherwise libvncserver already closed the marker or replaced it
+    if (cl->fileTransfer.fd == transfer->marker && !cl->fileTransfer.sending)
+    {
+        close(transfer->marker);
+        cl->fileTransfer.fd = -1;
+        cl->fileTransfer.receiving = 0;
+    }
+
+    close(transfer->file);
+    close(transfer->sock);
+    delete transfer;
+    state->transfer = NULL;
+}
+
+void updateTransfer(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL) { return; }
+
+    fileTransfer* transfer = state->transfer;
+    if (transfer != NULL)
+    {
+        // an abort or a new request changes what libvncserver holds
+        bool aborted = (cl->fileTransfer.fd != transfer->marker || cl->fileTransfer.sending);
+        if (aborted) { L("File transfer to %s aborted\n", cl->host); }
+
+        // libvncserver might have left out the finished hook of a frame
+        if (transfer->updateLocked)
+        {
+            UNLOCK(cl->sendMutex);
+            transfer->updateLocked = false;
+        }
+
+        if (aborted || transfer->finished)
+        {
+            bool timedOut = transfer->timedOut;
+            endTransfer(cl, state);
+            if (timedOut) { rfbCloseClient(cl); }
+            return;
+        }
+
+        int window = getAllowedBacklog(cl) / TRANSFER_SHARE;
+        transfer->window = (window < MIN_WINDOW) ? MIN_WINDOW : window;
+        return;
+    }
+
+    // encrypted and websocket connections cannot be written to directly
+    if (cl->fileTransfer.sending && cl->fileTransfer.fd >= 0 && cl->sslctx == NULL && cl->wsctx == NULL)
+    {
+        startTransfer(cl, state);
+    }
+}
+
+// libvncserver writes a frame in several pieces without taking sendMutex,
+// it is held from the display hook on so no file packet gets in between
+void beginUpdate(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL || state->transfer == NULL || state->transfer->updateLocked) { return; }
+
+    LOCK(cl->sendMutex);
+    state->transfer->updateLocked = true;
+}
+
+void endUpdate(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL || state->transfer == NULL || !state->transfer->updateLocked) { return; }
+
+    UNLOCK(cl->sendMutex);
+    state->transfer->updateLocked = false;
+}
+
+void stopTransfer(rfbClientPtr cl)
+{
+    clientState* state = getClientState(cl);
+    if (state == NULL || state->transfer == NULL) { return; }
+
+    endTransfer(cl, state);
+}
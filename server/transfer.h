@@ -0,0 +1,34 @@
+/*
+droid vnc server - Android VNC server
+Copyright (C) 2021 The emteria.OS project
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+extern "C" {
+    #include "rfb/rfb.h"
+}
+
+void updateTransfer(rfbClientPtr cl);
+void stopTransfer(rfbClientPtr cl);
+
+// called by the display hooks, frames are written in one piece while a file streams
+void beginUpdate(rfbClientPtr cl);
+void endUpdate(rfbClientPtr cl);
+
+#endif
@@ -20,8 +20,28 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 #include "common.h"
 #include "flinger.h"
+#include "capture.h"
+#include "framedump.h"
 #include "clipboard.h"
 #include "input.h"
+#include "injector.h"
+#include "keymap.h"
+#include "client.h"
+#include "quality.h"
+#include "backlog.h"
+#include "continuous.h"
+#include "events.h"
+#include "multitouch.h"
+#include "cuttext.h"
+#include "transfer.h"
+#include "metrics.h"
+#include "latency.h"
+#include "recording.h"
+#include "snapshot.h"
+#include "trace.h"
+
+#include <atomic>
+#include <thread>
 
 extern "C" {
     #include "libvncserver/scale.h"
@@ -32,6 +52,10 @@ extern "C" {
 
 //  port 5900 is bound natively in some Android devices
 int port = 5901;
+int metricsPort = 0;
+char* recordDirectory = NULL;
+char* dumpFile = NULL;
+char* replayFile = NULL;
 char* passwd = NULL;
 char* token = NULL;
 
@@ -40,9 +64,33 @@ unsigned int* vncbuf;
 
 uint32_t clients = 0;
 uint32_t idle = 0;
-uint32_t standby = 1;
 uint16_t scaling = 100;
 
+// how often a backed up client is checked for a drained socket (ms)
+const int BACKLOG_POLL = 5;
+
+// pause after a capture without changes, doubled up to 3 times (ms)
+const int IDLE_DELAY = 10;
+
+// how often libvncserver gets to push file transfer chunks (ms)
+const int TRANSFER_POLL = 1;
+
+// frame interval while replaying a dump, there is no display to ask (ms)
+const int REPLAY_PERIOD = 16;
+
+// time from the start until connections are accepted we aim for (ms)
+const int LISTEN_TARGET = 50;
+nsecs_t startupTime = 0;
+
+// sockets bound before the display is initialized
+int earlySock = -1;
+int earlySock6 = -1;
+
+// input is followed by a capture burst, so its effect shows up without delay (ms)
+const int BURST_INTERVAL = 16;
+const int BURST_DURATION = 500;
+std::atomic<nsecs_t> burstUntil(0);
+
 const char* defaultPassFile = "/data/vnc/password.bin";
 
 // reverse connection
@@ -52,29 +100,80 @@ int rport = 0;
 screenFormat screenformat;
 void (*update_screen)(void) = NULL;
 
-void setIdle(int i)
+// input arrives within rfbProcessEvents, the timer is armed right after it
+void startCaptureBurst()
+{
+    burstUntil = systemTime(SYSTEM_TIME_MONOTONIC) + ms2ns(BURST_DURATION);
+}
+
+void startupPhase(const char* phase)
+{
+    L("Startup: %s after %.1f ms\n", phase, (systemTime(SYSTEM_TIME_MONOTONIC) - startupTime) / 1e6);
+}
+
+// connections are queued by the kernel until the server accepts them,
+// so the port can be opened long before the screen is known
+void listenEarly()
+{
+    earlySock = rfbListenOnTCPPort(port, htonl(INADDR_ANY));
+    earlySock6 = rfbListenOnTCP6Port(port, NULL);
+    if (earlySock < 0 && earlySock6 < 0)
+    {
+        LE("Failed binding port %d early, retrying later\n", port);
+        return;
+    }
+
+    double elapsed = (systemTime(SYSTEM_TIME_MONOTONIC) - startupTime) / 1e6;
+    L("Startup: listening on port %d after %.1f ms (target %d ms)\n", port, elapsed, LISTEN_TARGET);
+}
+
+void adoptListenSocket(int sock, int* target)
 {
-    idle = i;
+    if (sock < 0) { return; }
+
+    *target = sock;
+    FD_SET(sock, &vncscr->allFds);
+    if (sock > vncscr->maxFd) { vncscr->maxFd = sock; }
 }
 
 void closeVncServer(int signo)
 {
     L("Cleaning up vncd (signo %d)...\n", signo);
 
+    closeCapture();
+    closeFrameDump();
     closeDisplay();
     closeFlinger();
     cleanupInput();
+    closeEvents();
+    closeMetrics();
+    closeSnapshots();
 
-    free(vncbuf);
     rfbScreenCleanup(vncscr);
+    closeRecording();
 
     exit(0);
 }
 
 void clientGone(rfbClientPtr cl)
 {
+    // usually closed already, which took it out of the event loop
+    if (cl->sock >= 0) { unwatchSocket(cl->sock); }
+
+    clientState* state = getClientState(cl);
+    if (state != NULL && state->recorder)
+    {
+        recorderGone(cl);
+        freeClientState(cl);
+        return;
+    }
+
     clients--;
     L("Client disconnected from %s. Total clients: %d\n", cl->host, clients);
+    releaseInput(cl);
+    stopTransfer(cl);
+    reportLatency(cl);
+    freeClientState(cl);
 
     if (clients == 0 && rhost != NULL)
     {
@@ -91,7 +190,7 @@ void rotateScreen(android::ui::Rotation rotation)
     if (oldLandscape != newLandscape)
     {
         // we need to restart the whole vncd to re-initialize display size
-        L("Cannot handle dimention flip when rotating screen, restarting vncd service...\n");
+        LW("Cannot handle dimention flip when rotating screen, restarting vncd service...\n");
         property_set("ctl.restart", "vncd");
     }
     else
@@ -104,9 +203,33 @@ void rotateScreen(android::ui::Rotation rotation)
 
 enum rfbNewClientAction clientHook(rfbClientPtr cl)
 {
-    clients++;
     cl->clientGoneHook = (ClientGoneHookPtr) clientGone;
-    L("Client connected from %s. Total clients: %d\n", cl->host, clients);
+    bool recorder = isRecorder(cl);
+    if (!recorder)
+    {
+        clients++;
+        L("Client connected from %s. Total clients: %d\n", cl->host, clients);
+    }
+
+    clientState* state = newClientState(cl);
+    if (state == NULL)
+    {
+        if (!recorder) { clients--; }
+        return RFB_CLIENT_REFUSE;
+    }
+
+    initQuality(cl);
+    if (recorder)
+    {
+        // paced like every other client, but not counted as one
+        state->recorder = true;
+        free(cl->host);
+        cl->host = strdup("recorder");
+    }
+    else
+    {
+        initBacklog(cl);
+    }
 
     if (scaling != 100)
     {
@@ -117,13 +240,33 @@ enum rfbNewClientAction clientHook(rfbClientPtr cl)
         rfbScalingSetup(cl, w, h);
     }
 
+    watchSocket(cl->sock);
     return RFB_CLIENT_ACCEPT;
 }
 
+// libvncserver encodes the update and writes it to the socket in between
+void displayHook(rfbClientPtr cl)
+{
+    beginUpdate(cl);
+    traceBegin("vncd:encode");
+    qualityUpdateStarted(cl);
+}
+
+void displayFinishedHook(rfbClientPtr cl, int result)
+{
+    endUpdate(cl);
+    traceEnd();
+    traceSendStarted(cl);
+    latencyUpdateSent(cl);
+    qualityUpdateFinished(cl);
+    continuousUpdateSent(cl);
+    countMetric(METRIC_UPDATES_SENT);
+}
+
 void setClipboardText(char* str, int len, struct _rfbClientRec* cl)
 {
-    L("Updating local clipboard with remote text\n");
-    setClipboard(len, str);
+    LD("Updating local clipboard with remote text\n");
+    setClipboardLatin1(len, str);
 }
 
 void setTextChat(struct _rfbClientRec* cl, int len, char* str)
@@ -134,17 +277,20 @@ void setTextChat(struct _rfbClientRec* cl, int len, char* str)
 void initVncServer()
 {
 	vncscr = rfbGetScreen(NULL, NULL, screenformat.width, screenformat.height, 0, 3, screenformat.bitsPerPixel/CHAR_BIT);
-	vncbuf = (unsigned int*) calloc(screenformat.width * screenformat.height, screenformat.bitsPerPixel/CHAR_BIT);
+	vncbuf = getFrontBuffer();
 
 	assert(vncscr != NULL);
 	assert(vncbuf != NULL);
 
 	vncscr->desktopName = (char*) "emteria.OS";
 	vncscr->frameBuffer = (char*) vncbuf;
-	vncscr->port = port;
-	vncscr->ipv6port = port;
+	// libvncserver only binds the ports which could not be opened early
+	vncscr->port = (earlySock < 0) ? port : 0;
+	vncscr->ipv6port = (earlySock6 < 0) ? port : 0;
 	vncscr->authPasswdData = passwd;
 	vncscr->newClientHook = (rfbNewClientHookPtr) clientHook;
+	vncscr->displayHook = displayHook;
+	vncscr->displayFinishedHook = displayFinishedHook;
 	vncscr->kbdAddEvent = keyEvent;
 	vncscr->ptrAddEvent = ptrEvent;
 	vncscr->setXCutText = setClipboardText;
@@ -164,12 +310,38 @@ void initVncServer()
 
 	vncscr->alwaysShared = TRUE;
 	vncscr->handleEventsEagerly = TRUE;
-	vncscr->deferUpdateTime = 10;
+	// frames are paced per client by the quality control
+	vncscr->deferUpdateTime = 0;
 
+	initContinuousUpdates();
+	initMultitouch();
+	initExtendedClipboard();
 	rfbInitServer(vncscr);
+	adoptListenSocket(earlySock, &vncscr->listenSock);
+	adoptListenSocket(earlySock6, &vncscr->listen6Sock);
+	vncscr->port = port;
+	vncscr->ipv6port = port;
+
 	rfbMarkRectAsModified(vncscr, 0, 0, screenformat.width, screenformat.height);
 }
 
+// scaled screens keep their own framebuffer which follows the changes,
+// returns the changed area in pixels
+int scaleDirtyRegion(sraRegionPtr dirty)
+{
+    int area = 0;
+    sraRect rect;
+    sraRectangleIterator* it = sraRgnGetIterator(dirty);
+    while (sraRgnIteratorNext(it, &rect))
+    {
+        rfbScaledScreenUpdate(vncscr, rect.x1, rect.y1, rect.x2, rect.y2);
+        area += (rect.x2 - rect.x1) * (rect.y2 - rect.y1);
+    }
+    sraRgnReleaseIterator(it);
+
+    return area;
+}
+
 void extractReverseHostPort(char *str)
 {
     int len = strlen(str);
@@ -178,7 +350,7 @@ void extractReverseHostPort(char *str)
     // copy in to host
     rhost = (char*) malloc(len+1);
     if (!rhost) {
-        L("Could not malloc string of size %d for reverse host\n", len);
+        LE("Could not malloc string of size %d for reverse host\n", len);
         closeVncServer(-1);
         return;
     }
@@ -237,6 +409,12 @@ void printUsage()
         "-P <port>\t- Custom port for the VNC server\n"
         "-R <host:port>\t- Host and port for reverse connection\n"
         "-t <token>\t- Session token for the reverse connection\n"
+        "-k <layout>\t- Keyboard layout configured in Android (us, de)\n"
+        "-m <port>\t- Serve Prometheus metrics and snapshots on this local port\n"
+        "-l <level>\t- Log level (0 errors, 1 warnings, 2 info, 3 debug, 4 verbose)\n"
+        "-r <dir>\t- Record sessions to FBS files in this directory\n"
+        "-d <file>\t- Dump captured frames to this file\n"
+        "-i <file>\t- Show a frame dump instead of the screen\n"
         "-h\t\t- Print this help\n"
         "-v\t\t- Output vncd version\n"
         "\n");
@@ -270,6 +448,30 @@ void parseArguments(int argc, char **argv)
 			i++;
 			port = atoi(argv[i]);
 			break;
+		case 'k':
+			i++;
+			setKeyboardLayout(argv[i]);
+			break;
+		case 'm':
+			i++;
+			metricsPort = atoi(argv[i]);
+			break;
+		case 'l':
+			i++;
+			setLogLevel(atoi(argv[i]));
+			break;
+		case 'r':
+			i++;
+			recordDirectory = argv[i];
+			break;
+		case 'd':
+			i++;
+			dumpFile = argv[i];
+			break;
+		case 'i':
+			i++;
+			replayFile = argv[i];
+			break;
                 case 's':
                     i++;
                     r = atoi(argv[i]);
@@ -294,6 +496,9 @@ void parseArguments(int argc, char **argv)
 
 int main(int argc, char **argv)
 {
+    startupTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    initLog();
+
     signal(SIGINT, closeVncServer);
     signal(SIGKILL, closeVncServer);
     signal(SIGILL, closeVncServer);
@@ -341,13 +546,29 @@ int main(int argc, char **argv)
         if (userPassSpecified) { L("User-specified password file is not readable\n"); }
     }
 
+    startupPhase("arguments parsed");
+    listenEarly();
+
+    // creating the virtual input device does not depend on the display
+    std::thread inputThread([] {
+        initInput();
+        startupPhase("input device ready");
+    });
+
     initFlinger();
-    int error = initDisplay();
+    startupPhase("binder thread pool started");
+
+    // the change listener needs the binder thread pool
+    int clipboardFd = initClipboard();
+
+    // a replayed dump brings its own screen format
+    int error = (replayFile != NULL) ? initReplay(replayFile) : initDisplay();
     if (error != 0)
     {
-        L("Failed initializing VNC display\n");
+        LE("Failed initializing VNC display\n");
         closeVncServer(-1);
     }
+    startupPhase("display initialized");
 
     L("Initializing VNC server:\n");
     L(" - rotation: %s\n", toCString(screenformat.rotation));
@@ -361,55 +582,191 @@ int main(int argc, char **argv)
     L(" - scaling: %d\n", scaling);
     L(" - port: %d\n", port);
 
-    initInput();
+    if (replayFile != NULL) { setCaptureSource(readReplay); }
+    if (dumpFile != NULL) { initFrameDump(dumpFile); }
+
+    if (initCapture() != 0)
+    {
+        LE("Failed initializing screen capture\n");
+        closeVncServer(-1);
+    }
+
+    // the first frame is captured while the server is set up
+    requestCapture();
+
     initVncServer();
+    startupPhase("server initialized");
+
+    inputThread.join();
+    setRefreshPeriod((replayFile != NULL) ? ms2ns(REPLAY_PERIOD) : getRefreshPeriod());
+
+    if (initEvents(getCaptureFd()) != 0)
+    {
+        LE("Failed initializing event loop\n");
+        closeVncServer(-1);
+    }
+
+    // clients are watched from the new client hook on
+    watchSocket(vncscr->listenSock);
+    watchSocket(vncscr->listen6Sock);
+    watchSocket(vncscr->udpSock);
 
     bool startRemote = (rhost != NULL);
     if (startRemote) { createReverseConnection(); }
+    if (clipboardFd >= 0) { watchEvents(clipboardFd, EVENT_CLIPBOARD); }
 
-    while (true)
+    if (metricsPort > 0)
     {
-        long usec = (vncscr->deferUpdateTime + standby) * 1000;
-        rfbProcessEvents(vncscr, usec);
+        int metricsFd = initMetrics(metricsPort);
+        if (metricsFd >= 0)
+        {
+            watchEvents(metricsFd, EVENT_METRICS);
+            initSnapshots();
+        }
+    }
+    if (recordDirectory != NULL) { initRecording(recordDirectory); }
+    startupPhase("entering event loop");
 
-        if (idle) { standby = 80; }
-             else { standby = 1; }
+    sraRegionPtr dirty = sraRgnCreate();
+    nsecs_t lastCapture = 0;
 
-        if (vncscr->clientHead == NULL)
+    while (true)
+    {
+        int events = waitEvents();
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+        if (events & EVENT_CAPTURE)
         {
-            idle = 1;
-            continue;
+            unsigned int* frame = takeCapture(dirty);
+            if (frame != NULL)
+            {
+                // the capture thread fills the other buffer from now on
+                vncbuf = frame;
+                vncscr->frameBuffer = (char*) vncbuf;
+
+                int area = scaleDirtyRegion(dirty);
+                countMetric(METRIC_FRAMES_CHANGED);
+                observeMetric(METRIC_DIRTY_RATIO, (double) area / (screenformat.width * screenformat.height));
+                latencyFrameCaptured(vncscr, dirty, getCaptureTime());
+                for (rfbClientPtr client_ptr = vncscr->clientHead; client_ptr; client_ptr = client_ptr->next)
+                {
+                    addPendingRegion(client_ptr, dirty);
+                }
+
+                idle = 0;
+            }
+            else
+            {
+                idle++;
+            }
+
+            if (replayFile == NULL)
+            {
+                android::ui::Rotation rotation = getScreenRotation();
+                if (screenformat.rotation != rotation) { rotateScreen(rotation); }
+            }
         }
 
-        android::ui::Rotation rotation = getScreenRotation();
-        if (screenformat.rotation != rotation) { rotateScreen(rotation); }
+        if (events & EVENT_METRICS) { serveMetrics(vncscr); }
+        updateSnapshots();
+
+        if ((events & EVENT_CLIPBOARD) && takeClipboardChange())
+        {
+            LD("Sending device clipboard to clients\n");
+            sendClipboardChange(vncscr);
+        }
 
-        bool needUpdates = false;
+        nsecs_t wait = -1;
+        bool transfers = false;
+        bool sending = false;
         for (rfbClientPtr client_ptr = vncscr->clientHead; client_ptr; client_ptr = client_ptr->next)
         {
-            // we will update the whole screen if at least one client has requested any update
+            // extended clipboard clients are read here, libvncserver does not select them
+            if (events & EVENT_SOCKET) { processCutText(client_ptr); }
+            updateQuality(client_ptr, now);
+            updateContinuous(client_ptr);
+
+            // hand the collected changes to every client whose frame interval has passed,
+            // the update is encoded from the newest frame once its socket is writable again
+            bool backlogged = isBacklogged(client_ptr);
+            clientState* state = getClientState(client_ptr);
+            if (state != NULL && state->sendTraced) { sending = true; }
+            if (hasPendingRegion(client_ptr) && getFrameDelay(client_ptr, now) == 0 && !backlogged)
+            {
+                flushPendingRegion(client_ptr);
+                latencyRegionFlushed(client_ptr);
+                scheduleFrame(client_ptr, now);
+            }
+
+            // we will capture the screen as soon as one requesting client is due for a frame,
+            // clients with a backed up socket skip frames until it drained
             if (!sraRgnEmpty(client_ptr->requestedRegion))
             {
-                needUpdates = true;
-                break;
+                nsecs_t delay = backlogged ? ms2ns(BACKLOG_POLL) : getFrameDelay(client_ptr, now);
+                if (wait < 0 || delay < wait) { wait = delay; }
             }
+
+            // downloads are streamed by a thread of their own, the others are sent by
+            // libvncserver in small chunks whenever the loop runs
+            updateTransfer(client_ptr);
+            if (client_ptr->fileTransfer.sending) { transfers = true; }
         }
 
-        if (!needUpdates)
+        // the recorder joins and leaves along with the viewers
+        updateRecording(vncscr, clients);
+
+        // input, new clients and the flushed regions are handled right away
+        rfbProcessEvents(vncscr, 0);
+        for (rfbClientPtr client_ptr = vncscr->clientHead; client_ptr; client_ptr = client_ptr->next)
         {
-            standby = 20;
-            continue;
+            finishPaste(client_ptr);
         }
 
-        bool hasUpdates = readBuffer(vncbuf);
-        if (!hasUpdates)
+        // input held back while the injection queue was full
+        flushInput();
+
+        if (vncscr->clientHead == NULL)
         {
-            standby = 10;
+            // nothing to do until the next client connects
+            idle = 0;
+            armTimer(-1);
             continue;
         }
 
-        // update the whole screen regardless of what client asked for
-        rfbMarkRectAsModified(vncscr, 0, 0, screenformat.width, screenformat.height);
+        // keep capturing at a high rate for a while after input, even before a client is due,
+        // so the next frame sent already shows the result
+        if (now < burstUntil)
+        {
+            idle = 0;
+            nsecs_t delay = lastCapture + ms2ns(BURST_INTERVAL) - now;
+            if (delay < 0) { delay = 0; }
+            if (wait < 0 || delay < wait) { wait = delay; }
+        }
+
+        // an unchanged screen is polled less often until something happens
+        if (wait >= 0 && idle > 0)
+        {
+            nsecs_t delay = lastCapture + ms2ns(IDLE_DELAY << (idle > 3 ? 3 : idle - 1)) - now;
+            if (delay > wait) { wait = delay; }
+        }
+
+        if (wait == 0 || (wait > 0 && wait < ms2ns(1)))
+        {
+            if (!isCaptureBusy())
+            {
+                requestCapture();
+                lastCapture = now;
+            }
+
+            // the capture thread wakes us up once the frame is ready
+            wait = -1;
+        }
+
+        if (transfers && (wait < 0 || wait > ms2ns(TRANSFER_POLL))) { wait = ms2ns(TRANSFER_POLL); }
+
+        // while tracing, send slices end close to the moment the socket queue drained
+        if (sending && (wait < 0 || wait > ms2ns(BACKLOG_POLL))) { wait = ms2ns(BACKLOG_POLL); }
+        armTimer(wait);
     }
 
     L("Terminating...\n");